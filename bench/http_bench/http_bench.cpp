@@ -0,0 +1,384 @@
+// 
+// http_bench.cpp : Load test the HTTP API server of the plugin, hosted in process against a stub SDK.
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+// Usage: http_bench [options]
+//   --plugin <path>          the plugin DLL, defaults to "io.github.richardchien.coolqhttpapi.dll" next to this executable
+//   --port <port>            the port of the HTTP API server, defaults to 5700
+//   --server-threads <n>     server_thread_pool_size of the plugin, defaults to 4
+//   --connections <n,n,...>  the numbers of keep-alive connections to try, defaults to 1,4,16,64
+//   --pipeline <n>           requests written at once on each connection, defaults to 1 (no pipelining)
+//   --duration <seconds>     how long each round measures, after a warm-up of one second, defaults to 10
+//   --target-rps <n>         the requests per second each round must reach at 16 connections or more,
+//                            defaults to 0 (not checked)
+//   --target-p99 <ms>        the p99 latency each round must stay under, defaults to 0 (not checked)
+// 
+// It enables the plugin with a config that only turns on the HTTP API server, then for each API
+// ("get_status" and "send_group_msg") and each number of connections, drives the server from that many threads,
+// one keep-alive connection each, and prints requests/sec, p50 and p99 latency, and whether the round met the targets.
+// A round with errors always misses. The exit code is the number of rounds that missed the targets.
+
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <Windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#define CQAPP_ID "io.github.richardchien.coolqhttpapi"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+namespace fs = boost::filesystem;
+
+struct Options {
+    string plugin;
+    unsigned short port = 5700;
+    size_t server_threads = 4;
+    vector<size_t> connections = {1, 4, 16, 64};
+    size_t pipeline = 1;
+    unsigned duration = 10;
+    double target_rps = 0;
+    double target_p99_ms = 0;
+};
+
+struct Api {
+    string name;
+    string request; // a complete HTTP/1.1 request, sent as is over and over
+};
+
+struct RoundResult {
+    size_t requests = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    double p50_ms = 0;
+    double p99_ms = 0;
+};
+
+static string executable_directory() {
+    char path[MAX_PATH];
+    const auto length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    const string file(path, length);
+    return file.substr(0, file.find_last_of('\\') + 1);
+}
+
+static Api make_get_api(const string &name, const Options &options) {
+    return {name, "GET /" + name + " HTTP/1.1\r\nHost: 127.0.0.1:" + to_string(options.port) + "\r\n\r\n"};
+}
+
+static Api make_post_api(const string &name, const string &body, const Options &options) {
+    return {name, "POST /" + name + " HTTP/1.1\r\nHost: 127.0.0.1:" + to_string(options.port) + "\r\n"
+                  "Content-Type: application/json\r\nContent-Length: " + to_string(body.size()) + "\r\n\r\n" + body};
+}
+
+/**
+ * One keep-alive connection to the server, which sends requests and reads their responses.
+ */
+class Connection {
+public:
+    explicit Connection(const unsigned short port) {
+        socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (socket_ == INVALID_SOCKET) {
+            throw runtime_error("failed to create socket");
+        }
+        BOOL no_delay = TRUE;
+        setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&no_delay), sizeof(no_delay));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        if (connect(socket_, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+            closesocket(socket_);
+            throw runtime_error("failed to connect");
+        }
+    }
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    ~Connection() { closesocket(socket_); }
+
+    bool send_all(const string &data) const {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const auto n = send(socket_, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+            if (n <= 0) {
+                return false;
+            }
+            sent += n;
+        }
+        return true;
+    }
+
+    /**
+     * Read one response, whose body must have a Content-Length.
+     * \return the status code, 0 if the connection failed
+     */
+    int read_response() {
+        size_t header_end;
+        while ((header_end = buffer_.find("\r\n\r\n")) == string::npos) {
+            if (!fill()) {
+                return 0;
+            }
+        }
+
+        int status = 0;
+        size_t content_length = 0;
+        istringstream header(buffer_.substr(0, header_end));
+        string line;
+        if (getline(header, line)) {
+            sscanf_s(line.c_str(), "HTTP/1.1 %d", &status);
+        }
+        while (getline(header, line)) {
+            if (boost::istarts_with(line, "Content-Length:")) {
+                content_length = stoul(line.substr(strlen("Content-Length:")));
+            }
+        }
+
+        const auto response_size = header_end + 4 + content_length;
+        while (buffer_.size() < response_size) {
+            if (!fill()) {
+                return 0;
+            }
+        }
+        buffer_.erase(0, response_size); // what's left belongs to the next (pipelined) response
+        return status;
+    }
+
+private:
+    SOCKET socket_;
+    string buffer_;
+
+    bool fill() {
+        char chunk[16384];
+        const auto n = recv(socket_, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer_.append(chunk, n);
+        return true;
+    }
+};
+
+static RoundResult run_round(const Api &api, const size_t connection_count, const Options &options) {
+    atomic<bool> measuring{false}, stopping{false};
+    vector<vector<double>> latencies(connection_count); // in milliseconds, one vector per connection
+    vector<size_t> errors(connection_count, 0);
+
+    string batch; // the requests written at once
+    for (size_t i = 0; i < options.pipeline; i++) {
+        batch += api.request;
+    }
+
+    vector<thread> threads;
+    for (size_t i = 0; i < connection_count; i++) {
+        threads.emplace_back([&, i] {
+            try {
+                Connection connection(options.port);
+                while (!stopping) {
+                    const auto start = Clock::now();
+                    if (!connection.send_all(batch)) {
+                        errors[i]++;
+                        return;
+                    }
+                    for (size_t j = 0; j < options.pipeline; j++) {
+                        const auto status = connection.read_response();
+                        if (status == 0) {
+                            errors[i]++;
+                            return;
+                        }
+                        // a pipelined request waits for the ones before it, which is part of its latency
+                        const chrono::duration<double, milli> latency = Clock::now() - start;
+                        if (measuring) {
+                            latencies[i].push_back(latency.count());
+                            if (status != 200) {
+                                errors[i]++;
+                            }
+                        }
+                    }
+                }
+            } catch (exception &) {
+                errors[i]++;
+            }
+        });
+    }
+
+    this_thread::sleep_for(chrono::seconds(1)); // warm up
+    const auto start = Clock::now();
+    measuring = true;
+    this_thread::sleep_for(chrono::seconds(options.duration));
+    measuring = false;
+    const chrono::duration<double> elapsed = Clock::now() - start;
+    stopping = true;
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    RoundResult result;
+    result.seconds = elapsed.count();
+    vector<double> all;
+    for (size_t i = 0; i < connection_count; i++) {
+        all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+        result.errors += errors[i];
+    }
+    result.requests = all.size();
+    if (!all.empty()) {
+        sort(all.begin(), all.end());
+        result.p50_ms = all[all.size() * 50 / 100];
+        result.p99_ms = all[min(all.size() * 99 / 100, all.size() - 1)];
+    }
+    return result;
+}
+
+static void write_config(const Options &options) {
+    char app_dir[MAX_PATH];
+    sprintf_s(app_dir, "%sstub_coolq\\app\\" CQAPP_ID "\\", executable_directory().c_str());
+    fs::create_directories(app_dir);
+    ofstream file(string(app_dir) + "config.cfg");
+    file << "[general]" << endl
+         << "host=127.0.0.1" << endl
+         << "port=" << options.port << endl
+         << "use_http=yes" << endl
+         << "use_ws=no" << endl
+         << "use_ws_reverse=no" << endl
+         << "post_url=" << endl
+         << "serve_data_files=no" << endl
+         << "auto_check_update=no" << endl
+         << "server_thread_pool_size=" << options.server_threads << endl;
+}
+
+static vector<size_t> parse_counts(const string &str) {
+    vector<string> parts;
+    boost::split(parts, str, boost::is_any_of(","));
+    vector<size_t> counts;
+    for (const auto &part : parts) {
+        counts.push_back(stoul(part));
+    }
+    return counts;
+}
+
+static Options parse_options(const int argc, char *argv[]) {
+    Options options;
+    options.plugin = executable_directory() + CQAPP_ID ".dll";
+    for (auto i = 1; i + 1 < argc; i += 2) {
+        const string key = argv[i], value = argv[i + 1];
+        if (key == "--plugin") {
+            options.plugin = value;
+        } else if (key == "--port") {
+            options.port = static_cast<unsigned short>(stoul(value));
+        } else if (key == "--server-threads") {
+            options.server_threads = stoul(value);
+        } else if (key == "--connections") {
+            options.connections = parse_counts(value);
+        } else if (key == "--pipeline") {
+            options.pipeline = max(stoul(value), 1ul);
+        } else if (key == "--duration") {
+            options.duration = stoul(value);
+        } else if (key == "--target-rps") {
+            options.target_rps = stod(value);
+        } else if (key == "--target-p99") {
+            options.target_p99_ms = stod(value);
+        } else {
+            throw invalid_argument("unknown option " + key);
+        }
+    }
+    return options;
+}
+
+int main(const int argc, char *argv[]) {
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (exception &e) {
+        cerr << "invalid options: " << e.what() << endl;
+        return -1;
+    }
+
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+
+    // host the plugin the way CoolQ does, it finds the stub CQP.dll next to this executable
+    write_config(options);
+    const auto plugin = LoadLibraryA(options.plugin.c_str());
+    if (!plugin) {
+        cerr << "failed to load " << options.plugin << endl;
+        return -1;
+    }
+    const auto initialize = reinterpret_cast<int32_t(__stdcall *)(int32_t)>(GetProcAddress(plugin, "Initialize"));
+    const auto enable = reinterpret_cast<int32_t(__stdcall *)()>(GetProcAddress(plugin, "Enable"));
+    const auto disable = reinterpret_cast<int32_t(__stdcall *)()>(GetProcAddress(plugin, "Disable"));
+    const auto exit_plugin = reinterpret_cast<int32_t(__stdcall *)()>(GetProcAddress(plugin, "Exit"));
+    if (!initialize || !enable || !disable || !exit_plugin) {
+        cerr << options.plugin << " is not the plugin" << endl;
+        return -1;
+    }
+    initialize(1);
+    enable();
+    this_thread::sleep_for(chrono::seconds(1)); // let the server start listening
+
+    const vector<Api> apis = {
+        make_get_api("get_status", options),
+        make_post_api("send_group_msg", R"({"group_id":123456,"message":"hello [CQ:face,id=14] world"})", options),
+    };
+
+    printf("server_thread_pool_size=%zu, pipeline=%zu, duration=%us\n", options.server_threads, options.pipeline,
+           options.duration);
+    if (options.target_rps > 0 || options.target_p99_ms > 0) {
+        printf("target: %.0f req/s at 16 connections or more, p99 < %.1f ms (0 is not checked)\n\n",
+               options.target_rps, options.target_p99_ms);
+    } else {
+        printf("target: none, only rounds with errors miss\n\n");
+    }
+    printf("%-16s %11s %10s %10s %9s %9s %7s  %s\n",
+           "api", "connections", "requests", "req/s", "p50 ms", "p99 ms", "errors", "target");
+
+    auto missed = 0;
+    for (const auto &api : apis) {
+        for (const auto connection_count : options.connections) {
+            const auto result = run_round(api, connection_count, options);
+            const auto rps = result.requests / result.seconds;
+            // fewer connections than 16 can't saturate the server, so they are only held to the latency target
+            const auto met = result.errors == 0
+                             && (options.target_p99_ms <= 0 || result.p99_ms < options.target_p99_ms)
+                             && (connection_count < 16 || rps >= options.target_rps);
+            if (!met) {
+                missed++;
+            }
+            printf("%-16s %11zu %10zu %10.0f %9.2f %9.2f %7zu  %s\n", api.name.c_str(), connection_count,
+                   result.requests, rps, result.p50_ms, result.p99_ms, result.errors, met ? "met" : "MISSED");
+        }
+    }
+
+    disable();
+    exit_plugin();
+    FreeLibrary(plugin);
+    WSACleanup();
+    return missed;
+}
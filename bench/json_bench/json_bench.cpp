@@ -0,0 +1,192 @@
+// 
+// json_bench.cpp : Measure parse and dump throughput of the JSON backend against nlohmann json on recorded events.
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+// Usage: json_bench [options]
+//   --events <path>          recorded events, one JSON text per line,
+//                            defaults to "..\bench\json_bench\events.jsonl" relative to this executable
+//   --duration <seconds>     how long each measurement runs, defaults to 3
+//   --target-speedup <x>     how many times faster than nlohmann json the backend must be, defaults to 1.5
+// 
+// It first checks that the backend reads every event to the same value as nlohmann json does,
+// and that what it writes reads back to the same value, then parses and dumps the events over and over
+// with each library and prints MB/s, events/s and the speedup.
+// The exit code is the number of measurements that missed the target, or -1 if the backend got an event wrong.
+
+#include <Windows.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "utils/json_backend.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+using json = nlohmann::json;
+
+struct Options {
+    string events;
+    unsigned duration = 3;
+    double target_speedup = 1.5;
+};
+
+struct Throughput {
+    double mb_per_second = 0;
+    double events_per_second = 0;
+};
+
+static string executable_directory() {
+    char path[MAX_PATH];
+    const auto length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    const string exe(path, length);
+    return exe.substr(0, exe.find_last_of('\\') + 1);
+}
+
+static Options parse_options(const int argc, char *argv[]) {
+    Options options;
+    options.events = executable_directory() + "..\\bench\\json_bench\\events.jsonl";
+    for (auto i = 1; i + 1 < argc; i += 2) {
+        const string key = argv[i], value = argv[i + 1];
+        if (key == "--events") {
+            options.events = value;
+        } else if (key == "--duration") {
+            options.duration = stoul(value);
+        } else if (key == "--target-speedup") {
+            options.target_speedup = stod(value);
+        } else {
+            throw invalid_argument("unknown option " + key);
+        }
+    }
+    return options;
+}
+
+static vector<string> read_events(const string &path) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        throw runtime_error("failed to open " + path);
+    }
+    vector<string> events;
+    for (string line; getline(file, line);) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            events.push_back(move(line));
+        }
+    }
+    if (events.empty()) {
+        throw runtime_error(path + " has no event");
+    }
+    return events;
+}
+
+/**
+ * Run "process" on every event, the whole list over and over, for "duration" seconds after a warm-up pass.
+ * "process" returns the size of what it produced, which is summed up so that the work can't be optimized away.
+ */
+template <typename T>
+static Throughput measure(const vector<T> &events, const size_t total_bytes, const unsigned duration,
+                          const function<size_t(const T &)> &process) {
+    static size_t sink = 0;
+    for (const auto &event : events) {
+        sink += process(event);
+    }
+
+    size_t passes = 0;
+    const auto start = Clock::now();
+    const auto deadline = start + chrono::seconds(duration);
+    do {
+        for (const auto &event : events) {
+            sink += process(event);
+        }
+        passes++;
+    } while (Clock::now() < deadline);
+    const auto seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    Throughput result;
+    result.mb_per_second = passes * total_bytes / seconds / (1024 * 1024);
+    result.events_per_second = passes * events.size() / seconds;
+    return result;
+}
+
+int main(const int argc, char *argv[]) {
+    Options options;
+    vector<string> texts;
+    try {
+        options = parse_options(argc, argv);
+        texts = read_events(options.events);
+    } catch (exception &e) {
+        cerr << e.what() << endl;
+        return -1;
+    }
+
+    vector<json> values;
+    size_t text_bytes = 0, dump_bytes = 0;
+    for (size_t i = 0; i < texts.size(); i++) {
+        json expected;
+        try {
+            expected = json::parse(texts[i]);
+        } catch (exception &e) {
+            cerr << "event " << i + 1 << " is invalid: " << e.what() << endl;
+            return -1;
+        }
+        const auto parsed = parse_json(texts[i]);
+        const auto dumped = dump_json(expected);
+        if (parsed != expected || json::parse(dumped) != expected) {
+            cerr << json_backend_name() << " got event " << i + 1 << " wrong" << endl;
+            return -1;
+        }
+        text_bytes += texts[i].size();
+        dump_bytes += dumped.size();
+        values.push_back(move(expected));
+    }
+
+    printf("%zu events, %zu bytes, backend: %s, duration=%us\n", texts.size(), text_bytes, json_backend_name(),
+           options.duration);
+    printf("target: %.2fx the throughput of nlohmann json\n\n", options.target_speedup);
+    printf("%-6s %-10s %10s %12s  %s\n", "op", "library", "MB/s", "events/s", "speedup");
+
+    auto missed = 0;
+    const auto report = [&](const char *op, const Throughput &baseline, const Throughput &backend) {
+        const auto speedup = backend.mb_per_second / baseline.mb_per_second;
+        const auto met = speedup >= options.target_speedup;
+        if (!met) {
+            missed++;
+        }
+        printf("%-6s %-10s %10.1f %12.0f\n", op, "nlohmann", baseline.mb_per_second, baseline.events_per_second);
+        printf("%-6s %-10s %10.1f %12.0f  %.2fx %s\n", op, json_backend_name(), backend.mb_per_second,
+               backend.events_per_second, speedup, met ? "met" : "MISSED");
+    };
+
+    report("parse",
+           measure<string>(texts, text_bytes, options.duration,
+                           [](const string &text) { return json::parse(text).size(); }),
+           measure<string>(texts, text_bytes, options.duration,
+                           [](const string &text) { return parse_json(text).size(); }));
+    report("dump",
+           measure<json>(values, dump_bytes, options.duration, [](const json &value) { return value.dump().size(); }),
+           measure<json>(values, dump_bytes, options.duration, [](const json &value) { return dump_json(value).size(); }));
+
+    return missed;
+}
@@ -0,0 +1,86 @@
+// 
+// stub_cqp.cpp : Define a stub of CoolQ's CQP.dll, for benchmarking the plugin without CoolQ.
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+// The plugin loads "CQP.dll" from the directory of the executable hosting it, so putting this DLL
+// next to http_bench.exe makes the plugin call these functions instead of CoolQ's.
+// Only the functions on the benchmarked paths (enabling the plugin, "get_status" and the message sending APIs)
+// do anything, they answer at once and never fail, so what is measured is the plugin itself.
+
+#include <Windows.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define CQAPP_ID "io.github.richardchien.coolqhttpapi"
+
+static const int64_t LOGIN_QQ = 10000;
+
+// base64 of a packed stranger info: user_id 10000, nickname "stub", sex 0, age 0
+static const char *STRANGER_INFO = "AAAAAAAAJxAABHN0dWIAAAAAAAAAAA==";
+
+static std::atomic<int32_t> next_message_id{1};
+
+static HMODULE this_module() {
+    HMODULE module = nullptr;
+    GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                       reinterpret_cast<LPCSTR>(&this_module), &module);
+    return module;
+}
+
+/**
+ * The app directory is "stub_coolq\app\<app id>\" under the directory of this DLL,
+ * http_bench writes the plugin's config file there before enabling it.
+ */
+static std::string app_directory() {
+    char path[MAX_PATH];
+    const auto length = GetModuleFileNameA(this_module(), path, MAX_PATH);
+    std::string dir(path, length);
+    dir = dir.substr(0, dir.find_last_of('\\') + 1);
+    return dir + "stub_coolq\\app\\" CQAPP_ID "\\";
+}
+
+#define STUB(ReturnType, FuncName, ...) extern "C" ReturnType __stdcall CQ_##FuncName(__VA_ARGS__)
+
+STUB(int32_t, sendPrivateMsg, int32_t, int64_t, const char *) { return next_message_id++; }
+
+STUB(int32_t, sendGroupMsg, int32_t, int64_t, const char *) { return next_message_id++; }
+
+STUB(int32_t, sendDiscussMsg, int32_t, int64_t, const char *) { return next_message_id++; }
+
+STUB(int32_t, deleteMsg, int32_t, int64_t) { return 0; }
+
+STUB(int64_t, getLoginQQ, int32_t) { return LOGIN_QQ; }
+
+STUB(const char *, getLoginNick, int32_t) { return "stub"; }
+
+STUB(const char *, getStrangerInfo, int32_t, int64_t, int32_t) { return STRANGER_INFO; }
+
+STUB(const char *, getCookies, int32_t) { return ""; }
+
+STUB(int32_t, getCsrfToken, int32_t) { return 0; }
+
+STUB(const char *, getAppDirectory, int32_t) {
+    static const auto dir = app_directory();
+    return dir.c_str();
+}
+
+STUB(int32_t, addLog, int32_t, int32_t, const char *, const char *) { return 0; }
+
+STUB(int32_t, setFatal, int32_t, const char *) { return 0; }
@@ -1,11 +1,17 @@
 #include "./api.h"
 
+#include "app.h"
+
+#include "utils/deadline_class.h"
+
 using namespace std;
 
 extern ApiHandlerMap api_handlers; // defined in handlers.cpp
 
 void invoke_api(const string &action, const Params &params, ApiResult &result) {
     if (const auto it = api_handlers.find(action); it != api_handlers.end()) {
+        // bound the requests the handler makes, e.g. to download the images of a message to send
+        Deadline::Scope deadline(config()->api_timeout);
         it->second(params, result);
     } else {
         throw invalid_argument("there is no api handler matching the given \"action\"");
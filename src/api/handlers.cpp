@@ -28,6 +28,8 @@
 #include "utils/params_class.h"
 #include "utils/http_utils.h"
 #include "service/hub_class.h"
+#include "event/journal_class.h"
+#include "utils/deadline_class.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -49,11 +51,11 @@ static bool __add_api_handler(const string &name, ApiHandler handler) {
 static void handle_async(const ApiHandler handler, const Params &params, ApiResult &result) {
     static const auto TAG = u8"API첽";
     if (pool) {
-        pool->push([handler, params, result](int) {
-            // copy "params" and "result" in the async task
-            auto async_params = params;
-            auto async_result = result;
-            handler(async_params, async_result);
+        // the task shares the (immutable) params, and owns a copy of the result which nobody else will read,
+        // and it is bounded by the deadline of the call, like the handlers run in place
+        pool->push([handler, params, async_result = result, deadline = Deadline::get()](int) mutable {
+            Deadline::Scope deadline_scope(deadline);
+            handler(params, async_result);
             Log::d(TAG, u8"ɹִһ API 첽");
         });
         Log::d(TAG, u8"API 첽ѽ̳߳صȴִ");
@@ -404,6 +406,77 @@ HANDLER(get_record) {
 
 #pragma endregion
 
+#pragma region Message Journal
+
+HANDLER(get_msg) {
+    const auto message_id = static_cast<int32_t>(params.get_integer("message_id", 0));
+    if (message_id) {
+        if (auto message = Journal::instance().get(message_id)) {
+            result.retcode = RetCodes::OK;
+            result.data = move(*message);
+        } else {
+            result.retcode = RetCodes::NOT_FOUND;
+        }
+    }
+}
+
+HANDLER(get_history) {
+    const auto message_type = params.get_string("message_type");
+    optional<Journal::MessageType> type;
+    int64_t id = 0;
+    if (message_type == "private") {
+        type = Journal::MessageType::PRIVATE;
+        id = params.get_integer("user_id", 0);
+    } else if (message_type == "group") {
+        type = Journal::MessageType::GROUP;
+        id = params.get_integer("group_id", 0);
+    } else if (message_type == "discuss") {
+        type = Journal::MessageType::DISCUSS;
+        id = params.get_integer("discuss_id", 0);
+    } else if (message_type.empty()) {
+        id = params.get_integer("user_id", 0); // messages sent by the user
+    }
+
+    // the cursor is the "next_cursor" returned before, a string, but it may also be sent as an integer,
+    // an invalid one fails the call like other invalid parameters
+    uint64_t before = 0;
+    if (const auto cursor = params.get("before"); cursor && cursor->is_number_integer()) {
+        if (!cursor->is_number_unsigned() && cursor->get<int64_t>() < 0) {
+            return;
+        }
+        before = cursor->get<uint64_t>();
+    } else if (cursor && cursor->is_string()) {
+        if (const auto &cursor_str = cursor->get_ref<const string &>(); !cursor_str.empty()) {
+            if (!boost::all(cursor_str, boost::is_digit())) {
+                return;
+            }
+            try {
+                before = stoull(cursor_str);
+            } catch (out_of_range &) {
+                return;
+            }
+        }
+    } else if (cursor && !cursor->is_null()) {
+        return;
+    }
+    const auto count = params.get_integer("count", 20);
+
+    if (id && count > 0) {
+        if (!Journal::instance().started()) {
+            result.retcode = RetCodes::NOT_FOUND;
+            return;
+        }
+        auto history = Journal::instance().history(type, id, before, static_cast<size_t>(min<int64_t>(count, 100)));
+        result.retcode = RetCodes::OK;
+        result.data = {
+            {"messages", move(history.first)},
+            {"next_cursor", history.second ? json(to_string(history.second)) : json(nullptr)}
+        };
+    }
+}
+
+#pragma endregion
+
 #pragma region Extras
 
 HANDLER(get_status) {
@@ -477,6 +550,10 @@ HANDLER(set_restart_plugin) {
     result.retcode = RetCodes::ASYNC;
 }
 
+HANDLER(reload_filter) {
+    result.retcode = app.reload_filter() ? RetCodes::OK : RetCodes::OPERATION_FAILED;
+}
+
 HANDLER(clean_data_dir) {
     const auto data_dir = params.get_string("data_dir");
     set<string> allowed_data_dirs = {"image", "record", "show", "bface"};
@@ -32,6 +32,7 @@ struct ApiResult {
         static const RetCode DEFAULT_ERROR = 100;
         static const RetCode INVALID_DATA = 102; // the data that CoolQ returns is invalid
         static const RetCode OPERATION_FAILED = 103; // the data that CoolQ returns is invalid
+        static const RetCode NOT_FOUND = 104; // the requested data isn't available, e.g. a message not in the journal
         static const RetCode BAD_THREAD_POOL = 201; // the thread pool isn't properly initiated
 
         // retcodes that represent HTTP status codes
@@ -46,23 +47,36 @@ struct ApiResult {
 
     ApiResult() : retcode(RetCodes::DEFAULT_ERROR) {}
 
-    json json() const {
-        std::string status;
+    nlohmann::json json() const & {
+        return {
+            {"status", status()},
+            {"retcode", retcode},
+            {"data", data}
+        };
+    }
+
+    /**
+     * Build the response JSON, moving "data" into it instead of copying.
+     */
+    nlohmann::json json() && {
+        nlohmann::json result = {
+            {"status", status()},
+            {"retcode", retcode}
+        };
+        result["data"] = std::move(data);
+        return result;
+    }
+
+private:
+    std::string status() const {
         switch (retcode) {
         case RetCodes::OK:
-            status = "ok";
-            break;
+            return "ok";
         case RetCodes::ASYNC:
-            status = "async";
-            break;
+            return "async";
         default:
-            status = "failed";
+            return "failed";
         }
-        return {
-            {"status", status},
-            {"retcode", retcode},
-            {"data", data}
-        };
     }
 };
 
@@ -35,7 +35,12 @@ extern Application app;
 extern std::optional<Sdk> sdk;
 
 #include "conf/config_struct.h"
-extern Config config;
+/**
+ * Get the configuration in effect. A reload never modifies it in place, but publishes a new one,
+ * so keep the returned pointer to read several options that belong together.
+ */
+std::shared_ptr<const Config> config();
+void publish_config(std::shared_ptr<const Config> new_config);
 
 #include "ctpl/ctpl_stl.h"
 extern std::shared_ptr<ctpl::thread_pool> pool;
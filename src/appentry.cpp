@@ -47,7 +47,7 @@ CQEVENT(int32_t, Initialize, 4)
 CQEVENT(int32_t, Enable, 0)
 () {
     app.enable();
-    if (config.auto_check_update) {
+    if (config()->auto_check_update) {
         pool->push([](int) {
             check_update(true);
         });
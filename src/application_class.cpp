@@ -21,15 +21,41 @@
 
 #include "app.h"
 
+#include <set>
 #include <boost/filesystem.hpp>
 
 #include "conf/loader.h"
 #include "service/hub_class.h"
 #include "event/filter.h"
+#include "event/events.h"
+#include "event/journal_class.h"
+#include "utils/curl_wrapper.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
 
+// the options that take effect without restarting, as they are read each time they are used
+static const set<string> LIVE_OPTIONS = {
+    "http_compression", "http_compression_level", "http_compression_threshold",
+    "ws_reverse_event_balance", "ws_reverse_reconnect_interval", "ws_reverse_reconnect_max_interval",
+    "ws_reverse_heartbeat_interval", "ws_reverse_reconnect_on_code_1000",
+    "post_url", "access_token", "secret", "post_timeout", "download_timeout", "remote_json_timeout", "api_timeout",
+    "post_message_format", "event_outbox_max_size", "event_outbox_max_age", "event_outbox_retry_interval",
+    "event_outbox_retry_max_interval", "event_outbox_sync_interval", "message_journal_max_days",
+    "serve_data_files", "update_source", "update_channel", "auto_check_update", "auto_perform_update",
+    "thread_pool_size", "convert_unicode_emoji", "use_filter",
+};
+
+static size_t thread_pool_size(const Config &c) {
+    return c.thread_pool_size > 0 ? c.thread_pool_size : thread::hardware_concurrency() * 2 + 1;
+}
+
+static time_t last_write_time(const string &path) {
+    boost::system::error_code ec;
+    const auto time = fs::last_write_time(ansi(path), ec);
+    return ec ? 0 : time;
+}
+
 void Application::initialize(const int32_t auth_code) {
     init_sdk(auth_code);
     initialized_ = true;
@@ -37,6 +63,7 @@ void Application::initialize(const int32_t auth_code) {
     restart_worker_running_ = true;
     restart_worker_thread_ = thread([&]() {
         static const auto tag = u8"";
+        unsigned ticks = 0;
         while (restart_worker_running_) {
             if (should_restart_) {
                 // this may not be thread-safe, but currently it's ok
@@ -48,6 +75,8 @@ void Application::initialize(const int32_t auth_code) {
                 disable();
                 enable();
                 Log::i(tag, u8"HTTP API ɹ");
+            } else if (enabled_ && ++ticks % 4 == 0) {
+                check_config_files(); // every 2 seconds
             }
             Sleep(500); // wait 500 ms for the next check
         }
@@ -64,22 +93,22 @@ void Application::enable() {
     Log::d(TAG, CQAPP_FULLNAME);
     Log::d(TAG, u8"ʼʼ");
 
+    config_file_time_ = last_write_time(sdk->directories().app() + "config.cfg");
     if (const auto c = load_configuration(sdk->directories().app() + "config.cfg")) {
-        config = c.value();
+        publish_config(make_shared<const Config>(c.value()));
     }
 
     ServiceHub::instance().start();
-
-    GlobalFilter::reset();
-    if (config.use_filter) {
-        GlobalFilter::load(sdk->directories().app() + "filter.json");
+    start_event_post();
+    if (config()->use_message_journal) {
+        Journal::instance().start();
     }
 
+    reload_filter();
+
     if (!pool) {
         Log::d(TAG, u8"̳߳شɹ");
-        pool = make_shared<ctpl::thread_pool>(
-            config.thread_pool_size > 0 ? config.thread_pool_size : thread::hardware_concurrency() * 2 + 1
-        );
+        pool = make_shared<ctpl::thread_pool>(static_cast<int>(thread_pool_size(*config())));
     }
 
     enabled_ = true;
@@ -93,6 +122,8 @@ void Application::disable() {
         return;
     }
 
+    stop_event_post();
+    Journal::instance().stop();
     ServiceHub::instance().stop();
 
     if (pool) {
@@ -100,6 +131,7 @@ void Application::disable() {
         pool = nullptr;
         Log::d(TAG, u8"̳߳عرճɹ");
     }
+    curl::stop_engine(); // the requests still in flight fail
 
     enabled_ = false;
     Log::i(TAG, u8"HTTP API ͣ");
@@ -119,6 +151,84 @@ void Application::restart_async(const unsigned long delay_millisecond) {
     should_restart_ = true; // this will let the restart worker do it
 }
 
+void Application::reload_config() {
+    static const auto TAG = u8"¼";
+
+    if (!enabled_) {
+        return;
+    }
+
+    const auto c = load_configuration(sdk->directories().app() + "config.cfg");
+    if (!c) {
+        Log::w(TAG, u8"ļʧܣʹõǰ");
+        return;
+    }
+    const auto old_config = config();
+    const auto new_config = make_shared<const Config>(c.value());
+
+    vector<string> changed;
+    for (const auto &option : new_config->values) {
+        if (const auto it = old_config->values.find(option.first);
+            it == old_config->values.end() || it->second != option.second) {
+            changed.push_back(option.first);
+        }
+    }
+    // an option that is gone changed too, the running servers may still be using its old value
+    for (const auto &option : old_config->values) {
+        if (new_config->values.find(option.first) == new_config->values.end()) {
+            changed.push_back(option.first);
+        }
+    }
+    for (const auto &key : changed) {
+        if (LIVE_OPTIONS.find(key) == LIVE_OPTIONS.end()) {
+            Log::i(TAG, u8" " + key + u8" ҪЧHTTP API ");
+            restart_async();
+            return;
+        }
+    }
+
+    publish_config(new_config);
+
+    if (pool && thread_pool_size(*new_config) != thread_pool_size(*old_config)) {
+        pool->resize(static_cast<int>(thread_pool_size(*new_config)));
+    }
+    reload_post_targets();
+    if (new_config->post_url != old_config->post_url) {
+        reload_post_outbox();
+    }
+    if (new_config->use_filter != old_config->use_filter) {
+        reload_filter();
+    }
+
+    Log::i(TAG, changed.empty()
+                    ? u8"¼"
+                    : u8"¼أЧ" + boost::algorithm::join(changed, ", "));
+}
+
+bool Application::reload_filter() {
+    if (!config()->use_filter) {
+        GlobalFilter::reset();
+        return false;
+    }
+    filter_file_time_ = last_write_time(sdk->directories().app() + "filter.json");
+    return GlobalFilter::load(sdk->directories().app() + "filter.json");
+}
+
+void Application::check_config_files() {
+    static const auto TAG = u8"¼";
+
+    if (const auto time = last_write_time(sdk->directories().app() + "config.cfg"); time != config_file_time_) {
+        config_file_time_ = time;
+        Log::i(TAG, u8"⵽ļ仯ʼ¼");
+        reload_config();
+    }
+    if (const auto time = last_write_time(sdk->directories().app() + "filter.json");
+        config()->use_filter && time != filter_file_time_) {
+        Log::i(TAG, u8"⵽˹ļ仯ʼ¼");
+        reload_filter();
+    }
+}
+
 bool Application::is_locked() const {
     return fs::exists(ansi(sdk->directories().app() + "app.lock"));
 }
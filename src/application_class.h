@@ -22,6 +22,8 @@
 
 #include "common.h"
 
+#include <atomic>
+
 class Application {
 public:
     void initialize(int32_t auth_code);
@@ -30,6 +32,18 @@ public:
     void exit();
     void restart_async(const unsigned long delay_millisecond = 0);
 
+    /**
+     * Load the configuration file again, and apply the changed options that don't need the services
+     * to be restarted, or restart if any other option has changed.
+     */
+    void reload_config();
+
+    /**
+     * Load "filter.json" again if "use_filter" is enabled, the current filter is kept if it can't be loaded.
+     * \return whether the filter was loaded
+     */
+    bool reload_filter();
+
     bool is_initialized() const { return initialized_; }
     bool is_enabled() const { return enabled_; }
 
@@ -43,4 +57,10 @@ private:
     unsigned long restart_delay_ = 0;
     std::thread restart_worker_thread_;
     bool restart_worker_running_ = false;
+
+    // last write time of the files watched by the restart worker
+    std::time_t config_file_time_ = 0;
+    std::atomic<std::time_t> filter_file_time_{0}; // also set by the "reload_filter" API
+
+    void check_config_files();
 };
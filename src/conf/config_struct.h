@@ -21,23 +21,72 @@
 
 #include "common.h"
 
+#include <map>
+
+/**
+ * An HTTP post target besides "post_url", configured in a "[post:<name>]" section.
+ */
+struct PostTargetConfig {
+    std::string name;
+    std::string url;
+    std::string secret;
+    unsigned long timeout = 0;
+    std::string filter; // path of a filter file, relative to the app directory, empty to post all events
+    bool wait = false;
+    bool primary = false; // whether the response is handled (e.g. quick operations) instead of that from "post_url"
+};
+
 struct Config {
     std::string host = "0.0.0.0";
     unsigned short port = 5700;
     bool use_http = false;
+    bool http_compression = true;
+    int http_compression_level = -1;
+    size_t http_compression_threshold = 1024;
     std::string ws_host = "0.0.0.0";
     unsigned short ws_port = 6700;
     bool use_ws = false;
+    size_t ws_send_queue_max_count = 1000;
+    size_t ws_send_queue_max_bytes = 16 * 1024 * 1024;
+    std::string ws_send_queue_overflow_policy = "drop_oldest";
+    bool ws_compression = false;
+    int ws_compression_level = -1;
+    bool ws_compression_no_context_takeover = false;
+    size_t ws_compression_threshold = 1024;
+    size_t ws_compression_max_message_size = 16777216;
     std::string ws_reverse_api_url = "";
     std::string ws_reverse_event_url = "";
+    std::string ws_reverse_url = "";
+    bool ws_reverse_use_universal_client = false;
+    size_t ws_reverse_universal_client_count = 1;
+    size_t ws_reverse_api_max_in_flight = 0;
+    std::string ws_reverse_event_balance = "round_robin";
     unsigned long ws_reverse_reconnect_interval = 3000;
+    unsigned long ws_reverse_reconnect_max_interval = 60000;
+    unsigned long ws_reverse_heartbeat_interval = 30000;
     bool ws_reverse_reconnect_on_code_1000 = true;
+    std::string ws_reverse_encoding = "json";
     bool use_ws_reverse = true;
     std::string post_url = "";
     std::string access_token = "";
     std::string secret = "";
+    std::vector<PostTargetConfig> post_targets;
+    unsigned long post_timeout = 10000;
+    unsigned long download_timeout = 60000;
+    unsigned long remote_json_timeout = 10000;
+    unsigned long api_timeout = 0;
     std::string post_message_format = "string";
+    bool use_event_outbox = false;
+    size_t event_outbox_max_size = 64 * 1024 * 1024;
+    unsigned long event_outbox_max_age = 86400;
+    unsigned long event_outbox_retry_interval = 1000;
+    unsigned long event_outbox_retry_max_interval = 60000;
+    unsigned long event_outbox_sync_interval = 1000;
+    bool use_message_journal = false;
+    unsigned message_journal_max_days = 7;
     bool serve_data_files = false;
+    size_t data_file_cache_size = 16 * 1024 * 1024;
+    size_t data_file_cache_max_file_size = 1024 * 1024;
     std::string update_source = "https://raw.githubusercontent.com/richardchien/coolq-http-api-release/master/";
     std::string update_channel = "stable";
     bool auto_check_update = false;
@@ -46,4 +95,6 @@ struct Config {
     size_t server_thread_pool_size = 1;
     bool convert_unicode_emoji = true;
     bool use_filter = false;
+
+    std::map<std::string, std::string> values; // the options above as loaded, by key, to tell which ones a reload changes
 };
@@ -87,27 +87,62 @@ optional<Config> load_configuration(const string &filepath) {
         #define GET_CONFIG(key, type) \
             auto __general_##key = pt.get<type>("general." #key, config.key); \
             config.key = pt.get<type>(login_qq_str + "." #key, __general_##key); \
+            config.values[#key] = to_string(config.key); \
             Log::d(TAG, #key "=" + to_string(config.key))
         #define GET_BOOL_CONFIG(key) \
             auto __general_##key = pt.get<bool>("general." #key, config.key, bool_translator); \
             config.key = pt.get<bool>(login_qq_str + "." #key, __general_##key, bool_translator); \
+            config.values[#key] = to_string(config.key); \
             Log::d(TAG, #key "=" + to_string(config.key))
         GET_CONFIG(host, string);
         GET_CONFIG(port, unsigned short);
         GET_BOOL_CONFIG(use_http);
+        GET_BOOL_CONFIG(http_compression);
+        GET_CONFIG(http_compression_level, int);
+        GET_CONFIG(http_compression_threshold, size_t);
         GET_CONFIG(ws_host, string);
         GET_CONFIG(ws_port, unsigned short);
         GET_BOOL_CONFIG(use_ws);
+        GET_CONFIG(ws_send_queue_max_count, size_t);
+        GET_CONFIG(ws_send_queue_max_bytes, size_t);
+        GET_CONFIG(ws_send_queue_overflow_policy, string);
+        GET_BOOL_CONFIG(ws_compression);
+        GET_CONFIG(ws_compression_level, int);
+        GET_BOOL_CONFIG(ws_compression_no_context_takeover);
+        GET_CONFIG(ws_compression_threshold, size_t);
+        GET_CONFIG(ws_compression_max_message_size, size_t);
         GET_CONFIG(ws_reverse_api_url, string);
         GET_CONFIG(ws_reverse_event_url, string);
+        GET_CONFIG(ws_reverse_url, string);
+        GET_BOOL_CONFIG(ws_reverse_use_universal_client);
+        GET_CONFIG(ws_reverse_universal_client_count, size_t);
+        GET_CONFIG(ws_reverse_api_max_in_flight, size_t);
+        GET_CONFIG(ws_reverse_event_balance, string);
         GET_CONFIG(ws_reverse_reconnect_interval, unsigned long);
+        GET_CONFIG(ws_reverse_reconnect_max_interval, unsigned long);
+        GET_CONFIG(ws_reverse_heartbeat_interval, unsigned long);
         GET_BOOL_CONFIG(ws_reverse_reconnect_on_code_1000);
+        GET_CONFIG(ws_reverse_encoding, string);
         GET_BOOL_CONFIG(use_ws_reverse);
         GET_CONFIG(post_url, string);
         GET_CONFIG(access_token, string);
         GET_CONFIG(secret, string);
+        GET_CONFIG(post_timeout, unsigned long);
+        GET_CONFIG(download_timeout, unsigned long);
+        GET_CONFIG(remote_json_timeout, unsigned long);
+        GET_CONFIG(api_timeout, unsigned long);
         GET_CONFIG(post_message_format, string);
+        GET_BOOL_CONFIG(use_event_outbox);
+        GET_CONFIG(event_outbox_max_size, size_t);
+        GET_CONFIG(event_outbox_max_age, unsigned long);
+        GET_CONFIG(event_outbox_retry_interval, unsigned long);
+        GET_CONFIG(event_outbox_retry_max_interval, unsigned long);
+        GET_CONFIG(event_outbox_sync_interval, unsigned long);
+        GET_BOOL_CONFIG(use_message_journal);
+        GET_CONFIG(message_journal_max_days, unsigned);
         GET_BOOL_CONFIG(serve_data_files);
+        GET_CONFIG(data_file_cache_size, size_t);
+        GET_CONFIG(data_file_cache_max_file_size, size_t);
         GET_CONFIG(update_source, string);
         GET_CONFIG(update_channel, string);
         GET_BOOL_CONFIG(auto_check_update);
@@ -118,6 +153,37 @@ optional<Config> load_configuration(const string &filepath) {
         GET_BOOL_CONFIG(use_filter);
         #undef GET_CONFIG
 
+        if (const auto &policy = config.ws_send_queue_overflow_policy;
+            policy != "drop_oldest" && policy != "drop_newest" && policy != "disconnect") {
+            Log::w(TAG, u8"ws_send_queue_overflow_policy ֵ " + policy + u8" Чʹ drop_oldest");
+        }
+
+        // the other post targets, one "[post:<name>]" section each, for all accounts
+        for (const auto &section : pt) {
+            if (!boost::starts_with(section.first, "post:")) {
+                continue;
+            }
+            PostTargetConfig target;
+            target.name = section.first.substr(strlen("post:"));
+            target.url = section.second.get<string>("url", "");
+            target.secret = section.second.get<string>("secret", config.secret);
+            target.timeout = section.second.get<unsigned long>("timeout", 0);
+            target.filter = section.second.get<string>("filter", "");
+            target.wait = section.second.get<bool>("wait", false, bool_translator);
+            target.primary = section.second.get<bool>("primary", false, bool_translator);
+            if (target.url.empty()) {
+                Log::w(TAG, u8"ϱĿ " + target.name + u8" û urlѺ");
+                continue;
+            }
+            if (target.primary && any_of(config.post_targets.cbegin(), config.post_targets.cend(),
+                                         [](const PostTargetConfig &t) { return t.primary; })) {
+                Log::w(TAG, u8"ϱĿ " + target.name + u8"  primaryϱĿ꣬ѺԴ");
+                target.primary = false;
+            }
+            Log::d(TAG, u8"ϱĿ " + target.name + u8"" + target.url);
+            config.post_targets.push_back(move(target));
+        }
+
         Log::i(TAG, u8"ļسɹ");
     } catch (...) {
         // failed to load configurations
@@ -2,9 +2,7 @@
 
 #include "common.h"
 
-#include <unordered_set>
-
-std::unordered_set<uint32_t> emoji_set = {
+static constexpr uint32_t emoji_codepoints[] = {
     8252,
     8265,
     8482,
@@ -855,3 +853,27 @@ std::unordered_set<uint32_t> emoji_set = {
     128708,
     128709,
 };
+
+/**
+ * One bit for each codepoint in [0, EMOJI_CODEPOINT_LIMIT), set if it's in "emoji_codepoints".
+ */
+struct EmojiBitmap {
+    static constexpr uint32_t EMOJI_CODEPOINT_LIMIT = 0x20000;
+
+    uint64_t words[EMOJI_CODEPOINT_LIMIT / 64];
+
+    constexpr bool test(const uint32_t codepoint) const {
+        return codepoint < EMOJI_CODEPOINT_LIMIT && (words[codepoint / 64] >> (codepoint % 64) & 1) != 0;
+    }
+};
+
+static constexpr EmojiBitmap make_emoji_bitmap() {
+    EmojiBitmap bitmap{};
+    for (const auto codepoint : emoji_codepoints) {
+        // fails to compile if a codepoint is out of the bitmap
+        bitmap.words[codepoint / 64] |= uint64_t(1) << (codepoint % 64);
+    }
+    return bitmap;
+}
+
+static constexpr auto emoji_bitmap = make_emoji_bitmap();
@@ -21,20 +21,163 @@
 
 #include "app.h"
 
+#include <future>
+
 #include "utils/params_class.h"
 #include "message/message_class.h"
 #include "structs.h"
 #include "service/hub_class.h"
 #include "utils/http_utils.h"
+#include "utils/json_backend.h"
+#include "utils/json_payload_class.h"
 #include "./filter.h"
+#include "./journal_class.h"
+#include "./outbox_class.h"
 
 using namespace std;
 
 #define ENSURE_POST_NEEDED \
-    if (config.post_url.empty() && !ServiceHub::instance().has_pushable_services()) { \
+    if (const auto conf = config(); conf->post_url.empty() && conf->post_targets.empty() \
+        && !ServiceHub::instance().has_pushable_services() && !Journal::instance().started()) { \
         return CQEVENT_IGNORE; \
     }
 
+static shared_ptr<Outbox> post_outbox;
+
+struct PostTarget {
+    PostTargetConfig config;
+    shared_ptr<IFilter> filter; // nullptr to post all events
+};
+
+static shared_ptr<const vector<PostTarget>> post_targets;
+
+void reload_post_targets() {
+    static const auto TAG = u8"ϱ";
+
+    const auto conf = config();
+    shared_ptr<vector<PostTarget>> targets;
+    if (!conf->post_targets.empty()) {
+        targets = make_shared<vector<PostTarget>>();
+        for (const auto &target_config : conf->post_targets) {
+            PostTarget target{target_config, nullptr};
+            if (!target_config.filter.empty()) {
+                target.filter = load_filter(sdk->directories().app() + target_config.filter);
+                if (!target.filter) {
+                    Log::e(TAG, u8"ϱĿ " + target_config.name + u8" Ĺ˹ʧܣϱ¼");
+                    continue;
+                }
+            }
+            targets->push_back(move(target));
+        }
+    }
+    atomic_store(&post_targets, shared_ptr<const vector<PostTarget>>(move(targets)));
+}
+
+void reload_post_outbox() {
+    if (const auto outbox = atomic_exchange(&post_outbox, shared_ptr<Outbox>())) {
+        outbox->stop(); // the events not yet delivered stay on disk, for the next outbox to retry
+    }
+
+    if (const auto conf = config(); conf->use_event_outbox && !conf->post_url.empty()) {
+        auto outbox = make_shared<Outbox>(
+            "HTTP", sdk->directories().app() + "outbox\\" + to_string(sdk->get_login_qq()) + "\\http\\",
+            [post_url = conf->post_url](const string &payload) { return post_json(post_url, payload).ok(); });
+        outbox->start();
+        atomic_store(&post_outbox, outbox);
+    }
+}
+
+void start_event_post() {
+    reload_post_targets();
+    reload_post_outbox();
+}
+
+void stop_event_post() {
+    atomic_store(&post_targets, shared_ptr<const vector<PostTarget>>());
+    if (const auto outbox = atomic_exchange(&post_outbox, shared_ptr<Outbox>())) {
+        outbox->stop();
+    }
+}
+
+/**
+ * The posts to the targets besides "post_url", which run concurrently with the post to "post_url".
+ */
+struct TargetPosts {
+    vector<future<HttpSimpleResponse>> waited; // of the other targets that should be waited for
+    optional<future<HttpSimpleResponse>> primary; // of the primary target, if it has one and the event is posted to it
+    bool has_primary = false; // whether a target is primary, so that the response from "post_url" is not handled
+};
+
+/**
+ * Post an event to the targets besides "post_url", concurrently and without waiting for them.
+ */
+static TargetPosts post_to_targets(const JsonPayload &event) {
+    static const auto TAG = u8"ϱ";
+
+    TargetPosts posts;
+    const auto targets = atomic_load(&post_targets);
+    if (!targets) {
+        return posts;
+    }
+
+    for (const auto &target : *targets) {
+        posts.has_primary = posts.has_primary || target.config.primary;
+        if (target.filter && !target.filter->eval(event.value())) {
+            continue;
+        }
+
+        HttpPostOptions options;
+        options.secret = target.config.secret;
+        options.timeout = target.config.timeout;
+        auto done = make_shared<promise<HttpSimpleResponse>>();
+        if (target.config.primary) {
+            posts.primary = done->get_future();
+        } else if (target.config.wait) {
+            posts.waited.push_back(done->get_future());
+        }
+        post_json_async(target.config.url, event.dump(), options,
+                        [name = target.config.name, done](const HttpSimpleResponse &resp) {
+                            if (resp.status_code == 0) {
+                                Log::d(TAG, u8"ϱĿ " + name + u8" ޷");
+                            } else {
+                                Log::d(TAG, u8"ͨ HTTP ϱݵϱĿ " + name + (resp.ok() ? u8" ɹ" : u8" ʧ")
+                                       + u8"״̬룺" + to_string(resp.status_code));
+                            }
+                            done->set_value(resp);
+                        });
+    }
+    return posts;
+}
+
+/**
+ * Handle the response to an event from the primary target, e.g. run the quick operations in it.
+ * \return whether the event should be blocked
+ */
+static bool handle_post_response(const HttpSimpleResponse &resp,
+                                 const function<void(const Params &)> &response_handler) {
+    static const auto TAG = u8"ϱ";
+
+    if (!resp.ok() || resp.body.empty()) {
+        return false;
+    }
+
+    Log::d(TAG, u8"յӦ " + resp.body);
+    try {
+        if (auto resp_payload = parse_json(resp.body); resp_payload.is_object()) {
+            Params params(move(resp_payload));
+
+            // custom handler
+            if (response_handler) response_handler(params);
+
+            return params.get_bool("block", false);
+        }
+    } catch (invalid_argument &) {
+        // failed to parse json
+        Log::d(TAG, u8"ϱӦЧ JSONѺ");
+    }
+    return false;
+}
+
 static int32_t post_event(json payload, const function<void(const Params &)> response_handler = nullptr) {
     static const auto TAG = u8"ϱ";
 
@@ -43,12 +186,9 @@ static int32_t post_event(json payload, const function<void(const Params &)> res
         payload["time"] = time(nullptr);
     }
 
-    auto should_block = false;
-
-
     if (!GlobalFilter::eval(payload)) {
         Log::d(TAG, u8"¼ѱأֹͣϱ");
-        goto finish;
+        return CQEVENT_IGNORE;
     }
 
     if (payload.find("message") != payload.end()) {
@@ -56,44 +196,52 @@ static int32_t post_event(json payload, const function<void(const Params &)> res
         payload["message"] = Message(payload["message"].get<string>()).process_inward();
     }
 
+    // from now on the payload is only read, and each serialized form of it is shared by all the receivers
+    const JsonPayload event(move(payload));
+    auto should_block = false;
 
-    if (!config.post_url.empty()) {
+    Journal::instance().append(event);
+
+    // the other targets are posted first, so that they run concurrently with the post to "post_url"
+    auto target_posts = post_to_targets(event);
+
+    if (const auto outbox = atomic_load(&post_outbox); outbox && !outbox->empty()) {
+        // earlier events are still waiting to be retried, this one must not overtake them
+        Log::d(TAG, u8"еȴͶݵ¼¼ѽ HTTP ϱԶ");
+        outbox->push(event.dump());
+    } else if (const auto post_url = config()->post_url; !post_url.empty()) {
         // do http post and handle response
         Log::d(TAG, u8"ʼͨ HTTP ϱ¼");
 
-        const auto resp = post_json(config.post_url, payload);
+        const auto resp = post_json(post_url, event.dump());
 
         if (resp.status_code == 0) {
-            Log::d(TAG, u8"HTTP ϱַ " + config.post_url + u8" ޷");
+            Log::d(TAG, u8"HTTP ϱַ " + post_url + u8" ޷");
         } else {
-            Log::d(TAG, u8"ͨ HTTP ϱݵ " + config.post_url + (resp.ok() ? u8" ɹ" : u8" ʧ")
+            Log::d(TAG, u8"ͨ HTTP ϱݵ " + post_url + (resp.ok() ? u8" ɹ" : u8" ʧ")
                    + u8"״̬룺" + to_string(resp.status_code));
         }
 
-        if (resp.ok() && !resp.body.empty()) {
-            Log::d(TAG, u8"յӦ " + resp.body);
-
-            try {
-                if (const auto resp_payload = json::parse(resp.body); resp_payload.is_object()) {
-                    Params params(move(resp_payload));
-
-                    // custom handler
-                    if (response_handler) response_handler(params);
+        if (!resp.ok() && outbox) {
+            Log::d(TAG, u8"¼ѽ HTTP ϱԶ");
+            outbox->push(event.dump());
+        }
 
-                    if (params.get_bool("block", false)) {
-                        should_block = true;
-                    }
-                }
-            } catch (invalid_argument &) {
-                // failed to parse json
-                Log::d(TAG, u8"ϱӦЧ JSONѺ");
-            }
+        if (!target_posts.has_primary) {
+            // "post_url" is the primary target unless another one is
+            should_block = handle_post_response(resp, response_handler);
         }
     }
 
-    ServiceHub::instance().push_event(payload);
+    if (target_posts.primary) {
+        should_block = handle_post_response(target_posts.primary->get(), response_handler);
+    }
+    for (const auto &post : target_posts.waited) {
+        post.wait();
+    }
+
+    ServiceHub::instance().push_event(event);
 
-finish:
     return should_block ? CQEVENT_BLOCK : CQEVENT_IGNORE;
 }
 
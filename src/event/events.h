@@ -21,6 +21,24 @@
 
 #include "common.h"
 
+/**
+ * Prepare the HTTP post targets besides "post_url",
+ * and start retrying the failed posts to "post_url" in the background, if "use_event_outbox" is enabled.
+ */
+void start_event_post();
+void stop_event_post();
+
+/**
+ * Prepare the HTTP post targets besides "post_url" again, from the configuration in effect.
+ */
+void reload_post_targets();
+
+/**
+ * Start retrying the failed posts to "post_url" in effect, if "use_event_outbox" is enabled,
+ * in place of the posts to the previous "post_url".
+ */
+void reload_post_outbox();
+
 int32_t event_private_msg(int32_t sub_type, int32_t msg_id, int64_t from_qq, const std::string &msg, int32_t font);
 int32_t event_group_msg(int32_t sub_type, int32_t msg_id, int64_t from_group, int64_t from_qq, const std::string &from_anonymous, const std::string &msg, int32_t font);
 int32_t event_discuss_msg(int32_t sub_Type, int32_t msg_id, int64_t from_discuss, int64_t from_qq, const std::string &msg, int32_t font);
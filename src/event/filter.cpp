@@ -263,50 +263,72 @@ shared_ptr<IFilter> construct_filter(const json &root_filter) {
     return construct_op("and", root_filter);
 }
 
-shared_ptr<IFilter> GlobalFilter::filter_ = nullptr;
-
-void GlobalFilter::load(const string &path) {
+shared_ptr<IFilter> load_filter(const string &path) {
     static const auto TAG = u8"¼";
 
-    filter_ = nullptr;
+    const auto ws_path = s2ws(path);
+    if (!fs::is_regular_file(ws_path)) {
+        Log::e(TAG, u8"ûҵ˹ļ " + path);
+        return nullptr;
+    }
 
-    if (const auto ws_path = s2ws(path); fs::is_regular_file(ws_path)) {
-        if (ifstream f(ws_path); f.is_open()) {
-            json filter_json;
-            f >> filter_json;
+    ifstream f(ws_path);
+    if (!f.is_open()) {
+        Log::e(TAG, u8"޷ȡ˹ļ " + path);
+        return nullptr;
+    }
 
-            try {
-                filter_ = construct_filter(filter_json);
-                Log::i(TAG, u8"˹سɹ");
-            } catch (FilterSyntexError &e) {
-                Log::e(TAG, string(u8"˹﷨󣬴Ϣ") + e.what());
-            }
-        }
-    } else {
-        Log::e(TAG, u8"ûҵ˹ļ filter.json");
+    try {
+        json filter_json;
+        f >> filter_json;
+        auto filter = construct_filter(filter_json);
+        Log::i(TAG, u8"˹ " + path + u8" سɹ");
+        return filter;
+    } catch (FilterSyntexError &e) {
+        Log::e(TAG, string(u8"˹﷨󣬴Ϣ") + e.what());
+    } catch (invalid_argument &e) {
+        Log::e(TAG, string(u8"˹ļЧ JSONϢ") + e.what());
     }
+    return nullptr;
+}
+
+shared_ptr<IFilter> GlobalFilter::filter_ = nullptr;
 
-    if (!filter_) {
-        // we was expecting to load a filter, but we failed
-        // so we should block all event by default
+bool GlobalFilter::load(const string &path) {
+    static const auto TAG = u8"¼";
 
-        class BlockAllFilter : public IFilter {
-        public:
-            bool eval(const json &) override { return false; }
-        };
+    // the filter is compiled before it is published, so events are never filtered by a partial one
+    if (auto filter = load_filter(path)) {
+        atomic_store(&filter_, move(filter));
+        return true;
+    }
 
-        filter_ = make_shared<BlockAllFilter>();
-        Log::e(TAG, u8"˹ʧܣͣ¼ϱ");
+    if (atomic_load(&filter_)) {
+        Log::e(TAG, u8"˹ʧܣʹԭеĹ˹");
+        return false;
     }
+
+    // we was expecting to load a filter, but we failed
+    // so we should block all event by default
+
+    class BlockAllFilter : public IFilter {
+    public:
+        bool eval(const json &) override { return false; }
+    };
+
+    atomic_store(&filter_, shared_ptr<IFilter>(make_shared<BlockAllFilter>()));
+    Log::e(TAG, u8"˹ʧܣͣ¼ϱ");
+    return false;
 }
 
 void GlobalFilter::reset() {
-    filter_ = nullptr;
+    atomic_store(&filter_, shared_ptr<IFilter>());
 }
 
 bool GlobalFilter::eval(const json &payload) {
-    if (!filter_) {
+    const auto filter = atomic_load(&filter_);
+    if (!filter) {
         return true;
     }
-    return filter_->eval(payload);
+    return filter->eval(payload);
 }
@@ -10,12 +10,23 @@ public:
 
 std::shared_ptr<IFilter> construct_filter(const json &root_filter);
 
+/**
+ * Load a filter from a JSON file, return nullptr (after logging why) if it can't be loaded.
+ */
+std::shared_ptr<IFilter> load_filter(const std::string &path);
+
 class GlobalFilter {
 public:
-    static void load(const std::string &path);
+    /**
+     * Load a filter and publish it in place of the current one, which is kept if the new one can't be loaded,
+     * or if there is none, all events are blocked.
+     * \return whether the filter was loaded
+     */
+    static bool load(const std::string &path);
     static void reset();
     static bool eval(const json &payload);
 
 private:
+    // replaced as a whole with atomic_store(), so that events being filtered keep the one they loaded
     static std::shared_ptr<IFilter> filter_;
 };
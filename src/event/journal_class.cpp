@@ -0,0 +1,372 @@
+#include "./journal_class.h"
+
+#include "app.h"
+
+#include <boost/filesystem.hpp>
+#include <zlib.h>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static const auto TAG = u8"Ϣ¼";
+
+static const size_t MAX_QUEUE_SIZE = 10000; // records waiting to be written, more are dropped
+
+static uint32_t date_of(const time_t t) {
+    tm local{};
+    localtime_s(&local, &t);
+    return (local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+}
+
+static bool is_journal_file(const fs::path &path) {
+    const auto stem = path.stem().string();
+    return path.extension() == ".log" && stem.size() == 8
+        && all_of(stem.begin(), stem.end(), [](const char c) { return c >= '0' && c <= '9'; });
+}
+
+static uint64_t make_position(const uint32_t date, const uint64_t offset) {
+    return static_cast<uint64_t>(date) << 32 | offset;
+}
+
+string Journal::file_path(const uint32_t date) const {
+    return dir_ + to_string(date) + ".log";
+}
+
+void Journal::start() {
+    if (running_) {
+        return;
+    }
+
+    dir_ = sdk->directories().app() + "journal\\" + to_string(sdk->get_login_qq()) + "\\";
+    vector<uint32_t> dates;
+    try {
+        fs::create_directories(ansi(dir_));
+        remove_expired();
+
+        for (fs::directory_iterator it(ansi(dir_)), end; it != end; ++it) {
+            if (fs::is_regular_file(it->status()) && is_journal_file(it->path())) {
+                dates.push_back(static_cast<uint32_t>(stoul(it->path().stem().string())));
+            }
+        }
+    } catch (fs::filesystem_error &e) {
+        Log::e(TAG, string(u8"޷ȡϢ¼Ŀ¼Ϣ") + e.what());
+        return;
+    }
+
+    // rebuild the indexes, oldest first so that the positions in them are in ascending order
+    sort(dates.begin(), dates.end());
+    for (const auto date : dates) {
+        load(date);
+    }
+    Log::d(TAG, u8"Ѽ " + to_string(by_message_id_.size()) + u8" Ϣ¼");
+
+    running_ = true;
+    thread_ = thread([this] { run(); });
+}
+
+void Journal::stop() {
+    {
+        unique_lock<mutex> lock(queue_mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    queue_cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    if (writer_) {
+        fclose(writer_);
+        writer_ = nullptr;
+    }
+    writer_date_ = 0;
+    {
+        unique_lock<shared_mutex> lock(index_mutex_);
+        by_message_id_.clear();
+        by_conversation_.clear();
+        by_user_.clear();
+    }
+    {
+        unique_lock<mutex> lock(reader_mutex_);
+        readers_.clear();
+    }
+}
+
+void Journal::load(const uint32_t date) {
+    const auto path = ansi(file_path(date));
+    boost::system::error_code ec;
+    const auto file_size = fs::file_size(path, ec);
+    ifstream f(path, ios::in | ios::binary);
+    if (ec || !f.is_open()) {
+        Log::w(TAG, u8"޷ȡϢ¼ļ " + file_path(date));
+        return;
+    }
+
+    unique_lock<shared_mutex> lock(index_mutex_);
+    uint64_t offset = 0;
+    Header header;
+    while (offset + sizeof(header) <= file_size && f.read(reinterpret_cast<char *>(&header), sizeof(header))
+        && offset + sizeof(header) + header.length <= file_size) {
+        index(header, make_position(date, offset));
+        offset += sizeof(header) + header.length;
+        f.seekg(offset);
+    }
+    lock.unlock();
+
+    if (offset < file_size) {
+        // a partial record written before a crash, cut it off so that new records can be appended
+        f.close();
+        fs::resize_file(path, offset, ec);
+        Log::w(TAG, u8"Ϣ¼ļ " + file_path(date) + u8" ĩβļ¼ѽض");
+    }
+}
+
+void Journal::index(const Header &header, const uint64_t position) {
+    by_message_id_[header.message_id] = position;
+    by_conversation_[{header.message_type, header.conversation_id}].push_back(position);
+    by_user_[header.user_id].push_back(position);
+}
+
+void Journal::remove_expired() {
+    if (config()->message_journal_max_days == 0) {
+        return;
+    }
+
+    // keep "message_journal_max_days" days, including today
+    const auto first_date = date_of(time(nullptr) - static_cast<time_t>(config()->message_journal_max_days - 1) * 86400);
+    const auto first_position = make_position(first_date, 0);
+
+    {
+        unique_lock<shared_mutex> lock(index_mutex_);
+        for (auto it = by_message_id_.begin(); it != by_message_id_.end();) {
+            it = it->second < first_position ? by_message_id_.erase(it) : next(it);
+        }
+        const auto remove_from = [first_position](auto &index) {
+            for (auto it = index.begin(); it != index.end();) {
+                auto &positions = it->second;
+                positions.erase(positions.begin(),
+                                lower_bound(positions.begin(), positions.end(), first_position));
+                it = positions.empty() ? index.erase(it) : next(it);
+            }
+        };
+        remove_from(by_conversation_);
+        remove_from(by_user_);
+    }
+    {
+        // the files can't be removed while they are open
+        unique_lock<mutex> lock(reader_mutex_);
+        readers_.erase(readers_.begin(), readers_.lower_bound(first_date));
+    }
+
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(ansi(dir_), ec), end; !ec && it != end; it.increment(ec)) {
+        if (is_journal_file(it->path()) && stoul(it->path().stem().string()) < first_date) {
+            boost::system::error_code remove_ec;
+            fs::remove(it->path(), remove_ec);
+        }
+    }
+}
+
+void Journal::append(const JsonPayload &event) {
+    if (!running_) {
+        return;
+    }
+
+    const auto &value = event.value();
+    Record record{};
+    try {
+        if (value.at("post_type").get<string>() != "message") {
+            return;
+        }
+        auto &header = record.header;
+        header.message_id = value.at("message_id").get<int32_t>();
+        header.user_id = value.at("user_id").get<int64_t>();
+        if (const auto message_type = value.at("message_type").get<string>(); message_type == "private") {
+            header.message_type = MessageType::PRIVATE;
+            header.conversation_id = header.user_id;
+        } else if (message_type == "group") {
+            header.message_type = MessageType::GROUP;
+            header.conversation_id = value.at("group_id").get<int64_t>();
+        } else if (message_type == "discuss") {
+            header.message_type = MessageType::DISCUSS;
+            header.conversation_id = value.at("discuss_id").get<int64_t>();
+        } else {
+            return;
+        }
+    } catch (exception &) {
+        // not a message event that we know
+        return;
+    }
+    record.data = event.msgpack();
+    record.header.length = static_cast<uint32_t>(record.data.size());
+    record.header.crc = static_cast<uint32_t>(
+        crc32(0, reinterpret_cast<const Bytef *>(record.data.data()), record.header.length));
+
+    {
+        unique_lock<mutex> lock(queue_mutex_);
+        if (queue_.size() >= MAX_QUEUE_SIZE) {
+            dropped_count_++;
+            return;
+        }
+        queue_.push_back(move(record));
+    }
+    queue_cv_.notify_one();
+}
+
+void Journal::write(deque<Record> &records) {
+    if (const auto today = date_of(time(nullptr)); !writer_ || today != writer_date_) {
+        if (writer_) {
+            fclose(writer_);
+            writer_ = nullptr;
+            remove_expired(); // a new day has begun
+        }
+        writer_date_ = today;
+        boost::system::error_code ec;
+        writer_offset_ = fs::file_size(ansi(file_path(today)), ec);
+        if (ec) {
+            writer_offset_ = 0;
+        }
+        writer_ = fopen(ansi(file_path(today)).c_str(), "ab");
+    }
+    if (!writer_) {
+        Log::e(TAG, u8"޷дϢ¼ļ " + file_path(writer_date_) + u8"Ѷ " + to_string(records.size())
+               + u8" Ϣ¼");
+        return;
+    }
+
+    vector<pair<Header, uint64_t>> written;
+    written.reserve(records.size());
+    for (const auto &record : records) {
+        const auto size = sizeof(record.header) + record.data.size();
+        if (writer_offset_ + size > UINT32_MAX) {
+            // offsets must fit in the low 32 bits of a position
+            Log::w(TAG, u8"Ϣ¼ļ " + file_path(writer_date_) + u8" ѴﵽСޣѶϢ¼");
+            break;
+        }
+        if (fwrite(&record.header, sizeof(record.header), 1, writer_) != 1
+            || fwrite(record.data.data(), 1, record.data.size(), writer_) != record.data.size()) {
+            Log::e(TAG, u8"дϢ¼ļ " + file_path(writer_date_) + u8" ʧ");
+            fclose(writer_);
+            writer_ = nullptr;
+            // cut off the partial record, the file will be reopened for the next records
+            boost::system::error_code ec;
+            fs::resize_file(ansi(file_path(writer_date_)), writer_offset_, ec);
+            break;
+        }
+        written.emplace_back(record.header, make_position(writer_date_, writer_offset_));
+        writer_offset_ += size;
+    }
+    if (writer_) {
+        fflush(writer_);
+    }
+
+    unique_lock<shared_mutex> lock(index_mutex_);
+    for (const auto &entry : written) {
+        index(entry.first, entry.second);
+    }
+}
+
+void Journal::run() {
+    unique_lock<mutex> lock(queue_mutex_);
+    while (running_ || !queue_.empty()) {
+        queue_cv_.wait(lock, [this] { return !running_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            continue;
+        }
+
+        deque<Record> records;
+        records.swap(queue_);
+        const auto dropped_count = exchange(dropped_count_, 0);
+        lock.unlock();
+
+        if (dropped_count > 0) {
+            Log::w(TAG, u8"Ϣ¼дѶ " + to_string(dropped_count) + u8" Ϣ¼");
+        }
+        write(records);
+
+        lock.lock();
+    }
+}
+
+optional<json> Journal::read(const uint64_t position) {
+    const auto date = static_cast<uint32_t>(position >> 32);
+    const auto offset = position & UINT32_MAX;
+
+    Header header;
+    vector<uint8_t> data;
+    {
+        unique_lock<mutex> lock(reader_mutex_);
+        auto &f = readers_[date];
+        if (!f.is_open()) {
+            f.open(ansi(file_path(date)), ios::in | ios::binary);
+        }
+        f.clear();
+        f.seekg(offset);
+        if (!f.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+            return nullopt;
+        }
+        data.resize(header.length);
+        if (!f.read(reinterpret_cast<char *>(data.data()), header.length)) {
+            return nullopt;
+        }
+    }
+
+    if (crc32(0, data.data(), header.length) != header.crc) {
+        Log::w(TAG, u8"Ϣ¼ļ " + file_path(date) + u8" еļ¼");
+        return nullopt;
+    }
+    try {
+        return json::from_msgpack(data);
+    } catch (exception &) {
+        return nullopt;
+    }
+}
+
+optional<json> Journal::get(const int32_t message_id) {
+    uint64_t position;
+    {
+        shared_lock<shared_mutex> lock(index_mutex_);
+        const auto it = by_message_id_.find(message_id);
+        if (it == by_message_id_.end()) {
+            return nullopt;
+        }
+        position = it->second;
+    }
+    return read(position);
+}
+
+pair<vector<json>, uint64_t> Journal::history(const optional<MessageType> type, const int64_t id,
+                                              const uint64_t before, const size_t count) {
+    vector<uint64_t> positions;
+    auto has_more = false;
+    {
+        shared_lock<shared_mutex> lock(index_mutex_);
+        const vector<uint64_t> *index = nullptr;
+        if (type) {
+            if (const auto it = by_conversation_.find({*type, id}); it != by_conversation_.end()) {
+                index = &it->second;
+            }
+        } else if (const auto it = by_user_.find(id); it != by_user_.end()) {
+            index = &it->second;
+        }
+        if (!index) {
+            return {};
+        }
+
+        const auto end = before > 0 ? lower_bound(index->begin(), index->end(), before) : index->end();
+        const auto begin = end - min(count, static_cast<size_t>(end - index->begin()));
+        positions.assign(begin, end);
+        has_more = begin != index->begin();
+    }
+
+    vector<json> messages;
+    messages.reserve(positions.size());
+    for (auto it = positions.rbegin(); it != positions.rend(); ++it) {
+        if (auto message = read(*it)) {
+            messages.push_back(move(*message));
+        }
+    }
+    return {move(messages), has_more ? positions.front() : 0};
+}
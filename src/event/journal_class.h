@@ -0,0 +1,119 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/json_payload_class.h"
+
+/**
+ * A local journal of the message events received, so that messages can be looked up afterwards
+ * (by the "get_msg" and "get_history" APIs).
+ *
+ * Records are appended to one file per day, by a background thread, so the event path only has to enqueue them.
+ * Each record has a fixed size header holding the fields it is indexed by, followed by the event in MessagePack.
+ * The indexes (by message id, by conversation and by sender) are kept in memory, and rebuilt from the headers
+ * on start, so a lookup reads only the records it returns.
+ *
+ * A record is located by its position, i.e. the date of its file (yyyymmdd) in the high 32 bits
+ * and its offset in the file in the low 32 bits, which increases with the time it was written.
+ */
+class Journal {
+public:
+    static Journal &instance() {
+        static Journal instance;
+        return instance;
+    }
+
+    enum class MessageType : uint8_t { PRIVATE = 1, GROUP = 2, DISCUSS = 3 };
+
+    void start();
+    void stop();
+
+    bool started() const { return running_; }
+
+    /**
+     * Enqueue a message event to be written, other events are ignored.
+     */
+    void append(const JsonPayload &event);
+
+    /**
+     * Return nullopt if there is no such message in the journal.
+     */
+    std::optional<json> get(const int32_t message_id);
+
+    /**
+     * \brief Get at most "count" messages of a conversation, or sent by a user if "type" is nullopt,
+     * written before the position "before" (0 means the latest ones), newest first.
+     * \return the messages, and the position to pass as "before" to get the page that follows (0 if none)
+     */
+    std::pair<std::vector<json>, uint64_t> history(const std::optional<MessageType> type, const int64_t id,
+                                                   const uint64_t before, const size_t count);
+
+private:
+    Journal() = default;
+
+    struct Header {
+        uint32_t length; // of the MessagePack data
+        uint32_t crc; // CRC-32 of the MessagePack data
+        int32_t message_id;
+        MessageType message_type;
+        uint8_t reserved[3];
+        int64_t conversation_id; // user id for private messages, group id or discuss id
+        int64_t user_id; // the sender
+    };
+    static_assert(sizeof(Header) == 32, "journal record header must be packed");
+
+    struct Record {
+        Header header;
+        std::string data;
+    };
+
+    using ConversationKey = std::pair<MessageType, int64_t>;
+
+    struct ConversationKeyHash {
+        size_t operator()(const ConversationKey &key) const {
+            return std::hash<int64_t>()(key.second) ^ static_cast<size_t>(key.first);
+        }
+    };
+
+    std::string dir_; // in UTF-8, ends with a path separator
+
+    // the queue to the writer thread
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::deque<Record> queue_;
+    size_t dropped_count_ = 0;
+    std::thread thread_;
+    std::atomic_bool running_{false};
+
+    // owned by the writer thread
+    std::FILE *writer_ = nullptr;
+    uint32_t writer_date_ = 0;
+    uint64_t writer_offset_ = 0;
+
+    // positions in each index are in ascending order
+    std::shared_mutex index_mutex_;
+    std::unordered_map<int32_t, uint64_t> by_message_id_;
+    std::unordered_map<ConversationKey, std::vector<uint64_t>, ConversationKeyHash> by_conversation_;
+    std::unordered_map<int64_t, std::vector<uint64_t>> by_user_;
+
+    std::mutex reader_mutex_;
+    std::map<uint32_t, std::ifstream> readers_; // by date
+
+    std::string file_path(const uint32_t date) const;
+    void load(const uint32_t date);
+    void index(const Header &header, const uint64_t position);
+    void remove_expired();
+    void write(std::deque<Record> &records);
+    std::optional<json> read(const uint64_t position);
+    void run();
+};
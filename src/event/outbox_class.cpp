@@ -0,0 +1,343 @@
+#include "./outbox_class.h"
+
+#include "app.h"
+
+#include <io.h>
+#include <iomanip>
+#include <boost/filesystem.hpp>
+#include <zlib.h>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static const auto TAG = u8"¼";
+
+static const uint64_t SEGMENT_SIZE = 4 * 1024 * 1024; // start a new segment once the current one is this large
+static const size_t RECORD_HEADER_SIZE = 16; // payload length (4 bytes), CRC-32 of payload (4 bytes), time (8 bytes)
+
+string Outbox::segment_path(const uint64_t id) const {
+    stringstream ss;
+    ss << dir_ << setw(16) << setfill('0') << hex << id << ".log";
+    return ss.str();
+}
+
+void Outbox::start() {
+    unique_lock<mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+
+    cursor_segment_id_ = 0;
+    cursor_offset_ = 0;
+    reader_segment_id_ = 0;
+    unsynced_ = false;
+
+    try {
+        fs::create_directories(ansi(dir_));
+
+        for (fs::directory_iterator it(ansi(dir_)), end; it != end; ++it) {
+            if (fs::is_regular_file(it->status()) && it->path().extension() == ".log") {
+                try {
+                    segments_.push_back({stoull(it->path().stem().string(), nullptr, 16), fs::file_size(it->path())});
+                } catch (logic_error &) {
+                    // not a segment
+                }
+            }
+        }
+    } catch (fs::filesystem_error &e) {
+        Log::e(TAG, u8"޷ȡ " + name_ + u8" ¼ԶĿ¼Ϣ" + e.what());
+    }
+    sort(segments_.begin(), segments_.end(), [](const Segment &a, const Segment &b) { return a.id < b.id; });
+    for (const auto &segment : segments_) {
+        total_size_ += segment.size;
+    }
+
+    if (ifstream f(ansi(dir_ + "cursor")); f >> cursor_segment_id_ >> cursor_offset_) {
+        // drop the segments delivered before the last restart
+        while (!segments_.empty() && segments_.front().id < cursor_segment_id_) {
+            drop_oldest_segment();
+        }
+    }
+    if (segments_.empty() || segments_.front().id != cursor_segment_id_) {
+        cursor_segment_id_ = segments_.empty() ? 1 : segments_.front().id;
+        cursor_offset_ = 0;
+    }
+
+    // the last segment may end with a partial record written before a crash, so never append to an old segment
+    const auto id = segments_.empty() ? cursor_segment_id_ : segments_.back().id + 1;
+    segments_.push_back({id, 0});
+    open_segment(id);
+    drop_consumed_segments();
+
+    if (!is_empty()) {
+        Log::i(TAG, u8" " + name_ + u8" ϴδͶݳɹ¼ " + to_string(total_size_) + u8" ֽڣʼͶ");
+    }
+
+    running_ = true;
+    attempts_ = 0;
+    next_attempt_ = Clock::now();
+    thread_ = thread([this] {
+        unique_lock<mutex> lock(mutex_);
+        run(lock);
+    });
+}
+
+void Outbox::stop() {
+    unique_lock<mutex> lock(mutex_);
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    cv_.notify_all();
+    lock.unlock();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    lock.lock();
+    sync();
+    if (writer_) {
+        fclose(writer_);
+        writer_ = nullptr;
+    }
+    reader_.close();
+    segments_.clear();
+    total_size_ = 0;
+}
+
+void Outbox::push(const string &payload) {
+    unique_lock<mutex> lock(mutex_);
+    if (!running_) {
+        return;
+    }
+    if (!writer_) {
+        Log::e(TAG, u8"޷д " + name_ + u8" ¼ԶУ¼Ѷ");
+        return;
+    }
+
+    const auto was_empty = is_empty();
+
+    char header[RECORD_HEADER_SIZE];
+    const auto length = static_cast<uint32_t>(payload.size());
+    const auto crc = static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef *>(payload.data()), length));
+    const auto time = static_cast<int64_t>(std::time(nullptr));
+    memcpy(header, &length, 4);
+    memcpy(header + 4, &crc, 4);
+    memcpy(header + 8, &time, 8);
+    if (fwrite(header, 1, sizeof(header), writer_) != sizeof(header)
+        || fwrite(payload.data(), 1, payload.size(), writer_) != payload.size()
+        || fflush(writer_) != 0) {
+        // the segment may now end with a partial record, which the reader will skip
+        Log::e(TAG, u8"д " + name_ + u8" ¼Զʧܣ¼Ѷ");
+        fclose(writer_);
+        writer_ = nullptr;
+        boost::system::error_code ec;
+        if (const auto size = fs::file_size(ansi(segment_path(segments_.back().id)), ec); !ec) {
+            total_size_ += size - segments_.back().size;
+            segments_.back().size = size;
+        }
+        segments_.push_back({segments_.back().id + 1, 0});
+        open_segment(segments_.back().id);
+        return;
+    }
+
+    const auto record_size = sizeof(header) + payload.size();
+    segments_.back().size += record_size;
+    total_size_ += record_size;
+    if (!unsynced_) {
+        unsynced_ = true;
+        next_sync_ = Clock::now() + chrono::milliseconds(config()->event_outbox_sync_interval);
+    }
+
+    if (segments_.back().size >= SEGMENT_SIZE) {
+        sync();
+        fclose(writer_);
+        segments_.push_back({segments_.back().id + 1, 0});
+        open_segment(segments_.back().id);
+    }
+
+    if (config()->event_outbox_max_size > 0 && total_size_ > config()->event_outbox_max_size) {
+        size_t dropped_count = 0;
+        while (total_size_ > config()->event_outbox_max_size && segments_.size() > 1) {
+            drop_oldest_segment();
+            dropped_count++;
+        }
+        if (dropped_count > 0) {
+            Log::w(TAG, name_ + u8" ¼Զѳ " + to_string(config()->event_outbox_max_size)
+                   + u8" ֽڣѶ " + to_string(dropped_count) + u8" ֶ");
+        }
+    }
+
+    if (was_empty) {
+        cv_.notify_all();
+    }
+}
+
+void Outbox::wake() {
+    unique_lock<mutex> lock(mutex_);
+    attempts_ = 0;
+    next_attempt_ = Clock::now();
+    cv_.notify_all();
+}
+
+bool Outbox::open_segment(const uint64_t id) {
+    writer_ = fopen(ansi(segment_path(id)).c_str(), "ab");
+    if (!writer_) {
+        Log::e(TAG, u8"޷ " + name_ + u8" ¼Զļ " + segment_path(id));
+    }
+    return writer_ != nullptr;
+}
+
+void Outbox::drop_consumed_segments() {
+    while (segments_.size() > 1
+        && cursor_segment_id_ == segments_.front().id && cursor_offset_ >= segments_.front().size) {
+        drop_oldest_segment();
+        unsynced_ = true; // the cursor has moved
+    }
+}
+
+void Outbox::drop_oldest_segment() {
+    const auto segment = segments_.front();
+    segments_.pop_front();
+    total_size_ -= segment.size;
+    if (cursor_segment_id_ <= segment.id) {
+        cursor_segment_id_ = segments_.empty() ? segment.id + 1 : segments_.front().id;
+        cursor_offset_ = 0;
+    }
+    if (reader_segment_id_ == segment.id) {
+        reader_.close(); // or the file can't be removed
+        reader_segment_id_ = 0;
+    }
+    boost::system::error_code ec;
+    fs::remove(ansi(segment_path(segment.id)), ec);
+}
+
+bool Outbox::read_record(string &payload, time_t &time, uint64_t &next_offset) {
+    const auto &segment = *find_if(segments_.cbegin(), segments_.cend(), [&](const Segment &s) {
+        return s.id == cursor_segment_id_;
+    });
+
+    if (reader_segment_id_ != segment.id) {
+        reader_.close();
+        reader_.open(ansi(segment_path(segment.id)), ios::in | ios::binary);
+        reader_segment_id_ = segment.id;
+    }
+    reader_.clear();
+    reader_.seekg(cursor_offset_);
+
+    char header[RECORD_HEADER_SIZE];
+    uint32_t length = 0, crc = 0;
+    int64_t record_time = 0;
+    if (cursor_offset_ + sizeof(header) <= segment.size && reader_.read(header, sizeof(header))) {
+        memcpy(&length, header, 4);
+        memcpy(&crc, header + 4, 4);
+        memcpy(&record_time, header + 8, 8);
+        if (cursor_offset_ + sizeof(header) + length <= segment.size) {
+            payload.resize(length);
+            if (length == 0 || reader_.read(&payload[0], length)) {
+                if (crc32(0, reinterpret_cast<const Bytef *>(payload.data()), length) == crc) {
+                    time = static_cast<time_t>(record_time);
+                    next_offset = cursor_offset_ + sizeof(header) + length;
+                    return true;
+                }
+            }
+        }
+    }
+
+    // a partial or corrupted record, the rest of this segment can't be trusted
+    Log::w(TAG, name_ + u8" ¼Զļ " + segment_path(segment.id) + u8" 𻵣ಿ");
+    cursor_offset_ = segment.size;
+    unsynced_ = true;
+    drop_consumed_segments();
+    return false;
+}
+
+void Outbox::sync() {
+    if (!unsynced_) {
+        return;
+    }
+    if (writer_) {
+        _commit(_fileno(writer_));
+    }
+    if (ofstream f(ansi(dir_ + "cursor"), ios::out | ios::trunc); f) {
+        f << cursor_segment_id_ << " " << cursor_offset_;
+    }
+    unsynced_ = false;
+}
+
+void Outbox::run(unique_lock<mutex> &lock) {
+    size_t expired_count = 0;
+
+    while (running_) {
+        const auto now = Clock::now();
+        if (unsynced_ && now >= next_sync_) {
+            sync();
+            if (expired_count > 0) {
+                Log::w(TAG, name_ + u8" ¼Զ " + to_string(expired_count) + u8" ¼ѹڣѶ");
+                expired_count = 0;
+            }
+        }
+
+        if (!is_empty() && now >= next_attempt_) {
+            string payload;
+            time_t time;
+            uint64_t next_offset;
+            if (!read_record(payload, time, next_offset)) {
+                continue;
+            }
+            const auto segment_id = cursor_segment_id_, offset = cursor_offset_;
+
+            auto delivered = false;
+            if (config()->event_outbox_max_age > 0
+                && std::time(nullptr) - time > static_cast<time_t>(config()->event_outbox_max_age)) {
+                expired_count++;
+                delivered = true; // as good as delivered
+            } else {
+                lock.unlock();
+                try {
+                    delivered = deliver_(payload);
+                } catch (...) {}
+                lock.lock();
+            }
+
+            if (delivered) {
+                attempts_ = 0;
+                // the segment may have been dropped by "push()" meanwhile, in which case the cursor has moved on
+                if (cursor_segment_id_ == segment_id && cursor_offset_ == offset) {
+                    cursor_offset_ = next_offset;
+                    drop_consumed_segments();
+                }
+                if (!unsynced_) {
+                    unsynced_ = true;
+                    next_sync_ = Clock::now() + chrono::milliseconds(config()->event_outbox_sync_interval);
+                }
+                if (is_empty()) {
+                    Log::i(TAG, name_ + u8" ¼Զе¼ȫͶ");
+                }
+            } else {
+                // exponential backoff, capped at "event_outbox_retry_max_interval"
+                const auto base_interval = max(config()->event_outbox_retry_interval, 1ul);
+                const auto max_interval = max(config()->event_outbox_retry_max_interval, base_interval);
+                auto interval = base_interval;
+                for (unsigned i = 0; i < attempts_ && interval < max_interval; i++) {
+                    interval *= 2;
+                }
+                interval = min(interval, max_interval);
+                attempts_++;
+                next_attempt_ = Clock::now() + chrono::milliseconds(interval);
+                Log::d(TAG, name_ + u8" ¼Ͷʧܣ " + to_string(interval) + u8" ");
+            }
+            continue;
+        }
+
+        if (!is_empty() && unsynced_) {
+            cv_.wait_until(lock, min(next_attempt_, next_sync_));
+        } else if (!is_empty()) {
+            cv_.wait_until(lock, next_attempt_);
+        } else if (unsynced_) {
+            cv_.wait_until(lock, next_sync_);
+        } else {
+            cv_.wait(lock);
+        }
+    }
+}
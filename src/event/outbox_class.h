@@ -0,0 +1,100 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+
+/**
+ * A durable queue of events that couldn't be delivered to one sink (the HTTP post url or the reverse websocket),
+ * which keeps retrying them in order, with exponential backoff, until the sink accepts them.
+ *
+ * Events are appended to segment files in "dir", and the position of the next event to deliver is kept in
+ * a cursor file there, so the queue survives restarts. Appends and the cursor are synced to disk in batches,
+ * so after a crash the events of the last "event_outbox_sync_interval" milliseconds may be lost or delivered twice.
+ * The oldest segments are dropped once the queue exceeds "event_outbox_max_size" bytes,
+ * and events older than "event_outbox_max_age" seconds are discarded instead of delivered.
+ */
+class Outbox {
+public:
+    /**
+     * Deliver a serialized event, return true if the sink has accepted it.
+     */
+    using Deliver = std::function<bool(const std::string &payload)>;
+
+    Outbox(std::string name, std::string dir, Deliver deliver)
+        : name_(std::move(name)), dir_(std::move(dir)), deliver_(std::move(deliver)) {}
+
+    ~Outbox() { stop(); }
+
+    Outbox(const Outbox &) = delete;
+    Outbox &operator=(const Outbox &) = delete;
+
+    void start();
+    void stop();
+
+    /**
+     * Whether no event is waiting, in which case new events may be delivered directly without breaking the order.
+     */
+    bool empty() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return is_empty();
+    }
+
+    void push(const std::string &payload);
+
+    /**
+     * Retry immediately instead of waiting for the backoff, e.g. after the sink reconnected.
+     */
+    void wake();
+
+private:
+    struct Segment {
+        uint64_t id;
+        uint64_t size;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    const std::string name_;
+    const std::string dir_; // in UTF-8, ends with a path separator
+    const Deliver deliver_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    bool running_ = false;
+
+    std::deque<Segment> segments_; // oldest first, the last one is being appended to
+    uint64_t total_size_ = 0;
+    std::FILE *writer_ = nullptr;
+    std::ifstream reader_;
+    uint64_t reader_segment_id_ = 0;
+
+    uint64_t cursor_segment_id_ = 0;
+    uint64_t cursor_offset_ = 0;
+
+    bool unsynced_ = false;
+    Clock::time_point next_sync_;
+    unsigned attempts_ = 0;
+    Clock::time_point next_attempt_;
+
+    // the following must be called with "mutex_" locked
+
+    bool is_empty() const {
+        return segments_.empty()
+            || (cursor_segment_id_ == segments_.back().id && cursor_offset_ == segments_.back().size);
+    }
+
+    std::string segment_path(const uint64_t id) const;
+    bool open_segment(const uint64_t id);
+    void drop_consumed_segments();
+    void drop_oldest_segment();
+    bool read_record(std::string &payload, std::time_t &time, uint64_t &next_offset);
+    void sync();
+    void run(std::unique_lock<std::mutex> &lock);
+};
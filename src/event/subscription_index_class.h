@@ -0,0 +1,200 @@
+// 
+// subscription_index_class.h : Define SubscriptionIndex class,
+// which maps events to the subscribers whose filters accept them.
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+#pragma once
+
+#include "common.h"
+
+#include <cmath>
+#include <map>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "./filter.h"
+
+/**
+ * Keep a compiled filter (same syntax as "filter.json") for each subscriber.
+ *
+ * Subscribers whose filter requires a top-level key to equal (or be ".in") some constants
+ * are indexed by that key, so matching an event only evaluates the filters that can possibly accept it.
+ */
+template <typename Subscriber>
+class SubscriptionIndex {
+public:
+    /**
+     * Subscribe with a filter, or replace the subscriber's current filter.
+     * A null filter accepts all events.
+     *
+     * \throw std::exception if the filter is invalid, in which case the current subscription is kept
+     */
+    void subscribe(const Subscriber &subscriber, const json &filter_json = nullptr) {
+        Subscription subscription;
+        if (!filter_json.is_null()) {
+            subscription.filter = construct_filter(filter_json);
+            extract_index_values(filter_json, subscription);
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        remove(subscriber);
+        if (subscription.index_key.empty()) {
+            unindexed_.insert(subscriber);
+        } else {
+            auto &buckets = index_[subscription.index_key];
+            for (const auto &value : subscription.index_values) {
+                buckets[value].insert(subscriber);
+            }
+        }
+        subscriptions_.emplace(subscriber, std::move(subscription));
+    }
+
+    void unsubscribe(const Subscriber &subscriber) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        remove(subscriber);
+    }
+
+    /**
+     * Return all subscribers whose filter accepts the payload.
+     */
+    std::vector<Subscriber> match(const json &payload) const {
+        std::vector<Subscriber> result;
+
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+
+        const auto try_subscriber = [&](const Subscriber &subscriber) {
+            const auto &filter = subscriptions_.at(subscriber).filter;
+            if (!filter || filter->eval(payload)) {
+                result.push_back(subscriber);
+            }
+        };
+
+        for (const auto &subscriber : unindexed_) {
+            try_subscriber(subscriber);
+        }
+
+        // every indexed subscriber lives in the buckets of exactly one key,
+        // and the payload has at most one value for that key, so there are no duplicates
+        for (const auto &key_buckets : index_) {
+            const auto it = payload.find(key_buckets.first);
+            if (it == payload.end()) {
+                continue;
+            }
+            if (const auto bucket_it = key_buckets.second.find(value_key(*it)); bucket_it != key_buckets.second.end()) {
+                for (const auto &subscriber : bucket_it->second) {
+                    try_subscriber(subscriber);
+                }
+            }
+        }
+
+        return result;
+    }
+
+    void clear() {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        subscriptions_.clear();
+        unindexed_.clear();
+        index_.clear();
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return subscriptions_.size();
+    }
+
+private:
+    struct Subscription {
+        std::shared_ptr<IFilter> filter;
+        std::string index_key;
+        std::vector<std::string> index_values; // see value_key()
+    };
+
+    std::map<Subscriber, Subscription> subscriptions_;
+    std::set<Subscriber> unindexed_;
+    std::unordered_map<std::string, std::unordered_map<std::string, std::set<Subscriber>>> index_;
+    mutable std::shared_mutex mutex_;
+
+    // ordered from the most to the least selective
+    static constexpr const char *INDEXABLE_KEYS[] = {"group_id", "user_id", "post_type"};
+
+    /**
+     * The key of a value in the buckets, which is its dumped JSON, except that numbers equal as the filters compare
+     * them (e.g. 12345 and 12345.0) have the same key.
+     */
+    static std::string value_key(const json &value) {
+        if (value.is_number_float()) {
+            // doubles in this range convert to int64_t exactly if they are integers
+            if (const auto number = value.get<double>();
+                std::floor(number) == number && number >= -9.2e18 && number <= 9.2e18) {
+                return std::to_string(static_cast<int64_t>(number));
+            }
+        }
+        return value.dump();
+    }
+
+    static void extract_index_values(const json &filter_json, Subscription &subscription) {
+        for (const auto key : INDEXABLE_KEYS) {
+            const auto it = filter_json.find(key);
+            if (it == filter_json.end()) {
+                continue;
+            }
+
+            if (!it->is_object()) {
+                //   "group_id": 12345
+                subscription.index_key = key;
+                subscription.index_values.push_back(value_key(*it));
+                return;
+            }
+
+            if (const auto in_it = it->find(".in"); it->size() == 1 && in_it != it->end() && in_it->is_array()) {
+                //   "group_id": {
+                //       ".in": [12345, 23456]
+                //   }
+                subscription.index_key = key;
+                for (const auto &value : *in_it) {
+                    subscription.index_values.push_back(value_key(value));
+                }
+                return;
+            }
+        }
+    }
+
+    void remove(const Subscriber &subscriber) {
+        const auto it = subscriptions_.find(subscriber);
+        if (it == subscriptions_.end()) {
+            return;
+        }
+
+        const auto &subscription = it->second;
+        if (subscription.index_key.empty()) {
+            unindexed_.erase(subscriber);
+        } else {
+            auto &buckets = index_[subscription.index_key];
+            for (const auto &value : subscription.index_values) {
+                if (const auto bucket_it = buckets.find(value); bucket_it != buckets.end()) {
+                    bucket_it->second.erase(subscriber);
+                    if (bucket_it->second.empty()) {
+                        buckets.erase(bucket_it);
+                    }
+                }
+            }
+        }
+        subscriptions_.erase(it);
+    }
+};
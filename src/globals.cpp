@@ -23,5 +23,13 @@ using namespace std;
 
 Application app; // always available while CoolQ is running
 optional<Sdk> sdk; // will be initialized in "Initialize" event
-Config config; // will be initiated in "Enable" event
+static shared_ptr<const Config> current_config = make_shared<Config>(); // will be replaced in "Enable" event
 shared_ptr<ctpl::thread_pool> pool; // will be initiated in "Enable" event
+
+shared_ptr<const Config> config() {
+    return atomic_load(&current_config);
+}
+
+void publish_config(shared_ptr<const Config> new_config) {
+    atomic_store(&current_config, move(new_config));
+}
@@ -21,7 +21,6 @@
 
 #include "app.h"
 
-#include <codecvt>
 #include <random>
 #include <openssl/hmac.h>
 #include <boost/compute/detail/lru_cache.hpp>
@@ -99,38 +98,180 @@ string hmac_sha1_hex(const string &key, const string &msg) {
 #include "emoji_data.h"
 
 bool is_emoji(const uint32_t codepoint) {
-    return emoji_set.find(codepoint) != emoji_set.end();
+    return emoji_bitmap.test(codepoint);
 }
 
-string string_to_coolq(const string &str) {
-    // call CoolQ API
+/**
+ * Decode the UTF-8 character at "pos", and advance "pos" past it.
+ * Invalid bytes are skipped one at a time, and decoded as 0.
+ */
+static uint32_t next_utf8_codepoint(const string &str, size_t &pos) {
+    const auto lead = static_cast<unsigned char>(str[pos]);
+    size_t len;
+    uint32_t codepoint;
+    if (lead < 0x80) {
+        pos++;
+        return lead;
+    } else if ((lead & 0xE0) == 0xC0) {
+        len = 2;
+        codepoint = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+        len = 3;
+        codepoint = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+        len = 4;
+        codepoint = lead & 0x07;
+    } else {
+        pos++;
+        return 0;
+    }
+
+    if (pos + len > str.size()) {
+        pos++;
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        const auto cont = static_cast<unsigned char>(str[pos + i]);
+        if ((cont & 0xC0) != 0x80) {
+            pos++;
+            return 0;
+        }
+        codepoint = codepoint << 6 | cont & 0x3F;
+    }
+    pos += len;
+    return codepoint;
+}
 
-    if (config.convert_unicode_emoji) {
-        string processed_str;
-
-        wstring_convert<codecvt_utf8<uint32_t>, uint32_t> uint32_conv;
-        auto uint32_str = uint32_conv.from_bytes(str);
-
-        auto append_text = [&](const decltype(uint32_str.cbegin()) &begin,
-                               const decltype(uint32_str.cbegin()) &end) {
-            decltype(uint32_str) uint32_part_str(begin, end);
-            auto utf8_part_str = uint32_conv.to_bytes(uint32_part_str);
-            processed_str += utf8_part_str;
-        };
-
-        auto last_it = uint32_str.cbegin();
-        for (auto it = uint32_str.cbegin(); it != uint32_str.cend(); ++it) {
-            const auto codepoint = *it;
-            if (is_emoji(codepoint)) {
-                // is emoji
-                append_text(last_it, it);
-                processed_str += "[CQ:emoji,id=" + to_string(codepoint) + "]";
-                last_it = it + 1;
-            }
+static void append_utf8(string &str, const uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        str += static_cast<char>(codepoint);
+    } else if (codepoint < 0x800) {
+        str += static_cast<char>(0xC0 | codepoint >> 6);
+        str += static_cast<char>(0x80 | codepoint & 0x3F);
+    } else if (codepoint < 0x10000) {
+        str += static_cast<char>(0xE0 | codepoint >> 12);
+        str += static_cast<char>(0x80 | codepoint >> 6 & 0x3F);
+        str += static_cast<char>(0x80 | codepoint & 0x3F);
+    } else {
+        str += static_cast<char>(0xF0 | codepoint >> 18);
+        str += static_cast<char>(0x80 | codepoint >> 12 & 0x3F);
+        str += static_cast<char>(0x80 | codepoint >> 6 & 0x3F);
+        str += static_cast<char>(0x80 | codepoint & 0x3F);
+    }
+}
+
+/**
+ * Replace emojis with "[CQ:emoji,id=...]" in a single pass, copying the string only if there is one.
+ */
+static string emoji_to_cq_code(const string &str) {
+    string result;
+    size_t copied_pos = 0;
+    for (size_t pos = 0; pos < str.size();) {
+        if (static_cast<unsigned char>(str[pos]) < 0x80) {
+            // all emojis are out of ASCII
+            pos++;
+            continue;
+        }
+        const auto begin = pos;
+        const auto codepoint = next_utf8_codepoint(str, pos);
+        if (is_emoji(codepoint)) {
+            result.append(str, copied_pos, begin - copied_pos);
+            result += "[CQ:emoji,id=" + to_string(codepoint) + "]";
+            copied_pos = pos;
+        }
+    }
+    if (copied_pos == 0) {
+        return str;
+    }
+    result.append(str, copied_pos, string::npos);
+    return result;
+}
+
+/**
+ * Replace "[CQ:emoji,id=...]" with the emojis it represents.
+ */
+static string emoji_from_cq_code(const string &str) {
+    static const string PREFIX = "[CQ:emoji,";
+
+    string result;
+    size_t copied_pos = 0;
+    for (auto pos = str.find(PREFIX); pos != string::npos; pos = str.find(PREFIX, pos)) {
+        // match "\[CQ:emoji,\s*id=(\d+)\]"
+        auto p = pos + PREFIX.size();
+        while (p < str.size() && isspace(static_cast<unsigned char>(str[p]))) {
+            p++;
         }
-        append_text(last_it, uint32_str.cend());
+        if (str.compare(p, 3, "id=") != 0) {
+            pos = p;
+            continue;
+        }
+        p += 3;
+        const auto digits_begin = p;
+        while (p < str.size() && isdigit(static_cast<unsigned char>(str[p]))) {
+            p++;
+        }
+        // an id longer than 10 digits can't be a codepoint, or a keycap ("100000" followed by a codepoint)
+        if (p == digits_begin || p - digits_begin > 10 || p >= str.size() || str[p] != ']') {
+            pos = p;
+            continue;
+        }
+
+        const auto id_str = str.substr(digits_begin, p - digits_begin);
+        const auto is_keycap = boost::starts_with(id_str, "100000");
+        const auto codepoint = stoull(is_keycap ? id_str.substr(strlen("100000")) : id_str);
+        if (codepoint > 0x10FFFF) {
+            pos = p;
+            continue;
+        }
+
+        result.append(str, copied_pos, pos - copied_pos);
+        append_utf8(result, static_cast<uint32_t>(codepoint));
+        if (is_keycap) {
+            // keycap # to keycap 9
+            append_utf8(result, 0xFE0F);
+            append_utf8(result, 0x20E3);
+        }
+        pos = copied_pos = p + 1;
+    }
+    if (copied_pos == 0) {
+        return str;
+    }
+    result.append(str, copied_pos, string::npos);
+    return result;
+}
+
+/**
+ * CoolQ sometimes use "#\uFE0F" to represent "#\uFE0F\u20E3",
+ * append the missing "\u20E3" to make them correct keycap emojis.
+ */
+static string complete_keycap_emoji(const string &str) {
+    static const string VS16 = "\xef\xb8\x8f"; // \uFE0F
+    static const string KEYCAP = "\xe2\x83\xa3"; // \u20E3
+
+    string result;
+    size_t copied_pos = 0;
+    for (auto pos = str.find(VS16, 1); pos != string::npos; pos = str.find(VS16, pos + 1)) {
+        const auto c = str[pos - 1];
+        if (!(c == '#' || c == '*' || c >= '0' && c <= '9') || str.compare(pos + VS16.size(), KEYCAP.size(), KEYCAP) == 0) {
+            continue;
+        }
+        const auto end = pos + VS16.size();
+        result.append(str, copied_pos, end - copied_pos);
+        result += KEYCAP;
+        copied_pos = end;
+    }
+    if (copied_pos == 0) {
+        return str;
+    }
+    result.append(str, copied_pos, string::npos);
+    return result;
+}
+
+string string_to_coolq(const string &str) {
+    // call CoolQ API
 
-        return iconv_string_encode(processed_str, "gb18030");
+    if (config()->convert_unicode_emoji) {
+        return iconv_string_encode(emoji_to_cq_code(str), "gb18030");
     }
 
     return iconv_string_encode(str, "gb18030");
@@ -140,34 +281,8 @@ string string_from_coolq(const string &str) {
     // handle CoolQ event or data
     auto result = iconv_string_decode(str, "gb18030");
 
-    if (config.convert_unicode_emoji) {
-        smatch m;
-
-        result = sregex_replace(result, regex(R"(\[CQ:emoji,\s*id=(\d+)\])"), [](const smatch &m) {
-            const auto codepoint_str = m.str(1);
-            u32string u32_str;
-
-            if (boost::starts_with(codepoint_str, "100000")) {
-                // keycap # to keycap 9
-                const auto codepoint = static_cast<char32_t>(stoul(codepoint_str.substr(strlen("100000"))));
-                u32_str.append({codepoint, 0xFE0F, 0x20E3});
-            } else {
-                const auto codepoint = static_cast<char32_t>(stoul(codepoint_str));
-                u32_str.append({codepoint});
-            }
-
-            const auto p = reinterpret_cast<const uint32_t *>(u32_str.data());
-            wstring_convert<codecvt_utf8<uint32_t>, uint32_t> conv;
-            return conv.to_bytes(p, p + u32_str.size());
-        });
-
-        // CoolQ sometimes use "#\uFE0F" to represent "#\uFE0F\u20E3"
-        // we should convert them into correct emoji codepoints here
-        //     \uFE0F == \xef\xb8\x8f
-        //     \u20E3 == \xe2\x83\xa3
-        result = sregex_replace(result, regex("([#*0-9]\xef\xb8\x8f)(\xe2\x83\xa3)?"), [](const smatch &m) {
-            return m.str(1) + "\xe2\x83\xa3";
-        });
+    if (config()->convert_unicode_emoji) {
+        result = complete_keycap_emoji(emoji_from_cq_code(result));
     }
 
     return result;
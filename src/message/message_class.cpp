@@ -199,7 +199,7 @@ Message::Message(const json &msg_json) {
     if (msg_json.is_string()) {
         this->segments_ = split(msg_json.get<string>());
     } else if (msg_json.is_array()) {
-        for (auto seg : msg_json) {
+        for (const auto &seg : msg_json) {
             if (seg.is_object()) {
                 try {
                     this->segments_.push_back(seg.get<Segment>());
@@ -221,7 +221,7 @@ string Message::process_outward() const {
 
 json Message::process_inward(optional<Format> fmt) const {
     if (!fmt) {
-        fmt = config.post_message_format;
+        fmt = config()->post_message_format;
     }
 
     list<Segment> segments;
@@ -10,20 +10,20 @@
 using namespace std;
 
 void ServiceHub::start() {
-    if (config.use_http) {
+    if (config()->use_http) {
         auto service = make_shared<HttpService>();
         services_["http"] = service;
         service->start();
     }
 
-    if (config.use_ws) {
+    if (config()->use_ws) {
         auto service = make_shared<WsService>();
         services_["ws"] = service;
         pushable_services_.push_back(service);
         service->start();
     }
 
-    if (config.use_ws_reverse) {
+    if (config()->use_ws_reverse) {
         auto service = make_shared<WsReverseService>();
         services_["ws_reverse"] = service;
         pushable_services_.push_back(service);
@@ -55,7 +55,7 @@ bool ServiceHub::good() const {
     });
 }
 
-void ServiceHub::push_event(const json &payload) const {
+void ServiceHub::push_event(const JsonPayload &payload) const {
     for (const auto &service : pushable_services_) {
         service->push_event(payload);
     }
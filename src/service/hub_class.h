@@ -17,7 +17,7 @@ public:
     bool heartbeat() const override;
     bool good() const override;
 
-    void push_event(const json &payload) const override;
+    void push_event(const JsonPayload &payload) const override;
     bool has_pushable_services() const { return !pushable_services_.empty(); }
 
     using ServiceMap = std::map<std::string, std::shared_ptr<ServiceBase>>;
@@ -0,0 +1,94 @@
+#include "./data_file_cache_class.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+using namespace std;
+namespace ipc = boost::interprocess;
+
+/**
+ * Get the size and the last write time of a file, the latter in 100-nanosecond intervals since 1601-01-01 (UTC).
+ * boost::filesystem::last_write_time() has whole seconds only, which can't tell a same-size rewrite within one second.
+ *
+ * \throw std::runtime_error if the file can't be found
+ */
+static pair<size_t, uint64_t> file_size_and_write_time(const string &ansi_filepath) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(ansi_filepath.c_str(), GetFileExInfoStandard, &attributes)) {
+        throw runtime_error("failed to get file attributes");
+    }
+    const auto size = static_cast<uint64_t>(attributes.nFileSizeHigh) << 32 | attributes.nFileSizeLow;
+    const auto write_time = static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32
+                            | attributes.ftLastWriteTime.dwLowDateTime;
+    return {static_cast<size_t>(size), write_time};
+}
+
+static string make_etag(const size_t size, const uint64_t write_time) {
+    // a strong validator, as long as the file system records write times finer than its rewrites
+    stringstream ss;
+    ss << '"' << hex << size << '-' << write_time << '"';
+    return ss.str();
+}
+
+DataFile DataFileCache::get(const string &ansi_filepath) {
+    static const uint64_t UNIX_EPOCH_WRITE_TIME = 116444736000000000; // 1970-01-01 in 100-nanosecond intervals
+    static const uint64_t WRITE_TIME_TICKS_PER_SECOND = 10000000;
+
+    DataFile file;
+    const auto [size, write_time] = file_size_and_write_time(ansi_filepath);
+    file.size = size;
+    file.last_modified = static_cast<time_t>((write_time - UNIX_EPOCH_WRITE_TIME) / WRITE_TIME_TICKS_PER_SECOND);
+    file.etag = make_etag(file.size, write_time);
+
+    unique_lock<mutex> lock(mutex_);
+    const auto cacheable = file.size <= max_file_size_ && file.size <= capacity_;
+    if (const auto it = entries_.find(ansi_filepath); it != entries_.end()) {
+        if (it->second->second.etag == file.etag) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+        // the file has changed
+        size_ -= it->second->second.size;
+        lru_.erase(it->second);
+        entries_.erase(it);
+    }
+    lock.unlock();
+
+    if (file.size == 0) {
+        // an empty file can't be mapped
+        file.owner = make_shared<string>();
+    } else if (cacheable) {
+        auto content = make_shared<string>();
+        content->resize(file.size);
+        if (ifstream f(ansi_filepath, ios::in | ios::binary);
+            !f.is_open() || !f.read(&(*content)[0], file.size)) {
+            throw runtime_error("failed to read file");
+        }
+        file.data = content->data();
+        file.owner = move(content);
+    } else {
+        const ipc::file_mapping mapping(ansi_filepath.c_str(), ipc::read_only);
+        auto region = make_shared<ipc::mapped_region>(mapping, ipc::read_only, 0, file.size);
+        file.data = static_cast<const char *>(region->get_address());
+        file.owner = move(region);
+    }
+
+    if (cacheable) {
+        lock.lock();
+        if (entries_.find(ansi_filepath) == entries_.end()) {
+            evict(file.size);
+            lru_.emplace_front(ansi_filepath, file);
+            entries_.emplace(ansi_filepath, lru_.begin());
+            size_ += file.size;
+        }
+    }
+    return file;
+}
+
+void DataFileCache::evict(const size_t room_needed) {
+    while (!lru_.empty() && size_ + room_needed > capacity_) {
+        size_ -= lru_.back().second.size;
+        entries_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Content of a file in the data directory, which stays valid as long as "owner" is alive.
+ */
+struct DataFile {
+    std::shared_ptr<const void> owner; // the cached content, or the memory mapped file
+    const char *data = nullptr;
+    size_t size = 0;
+    std::time_t last_modified = 0;
+    std::string etag;
+};
+
+/**
+ * Load files for the data file handler of HttpService.
+ *
+ * Files no larger than "max_file_size" are kept in memory, least recently used ones are evicted
+ * when the total size exceeds "capacity". Larger files are memory mapped for each request.
+ * A cached file is reloaded once its size or modification time (at the file system's resolution) changes.
+ */
+class DataFileCache {
+public:
+    void configure(const size_t capacity, const size_t max_file_size) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        max_file_size_ = max_file_size;
+        evict(0);
+    }
+
+    /**
+     * \throw std::exception if the file can't be read
+     */
+    DataFile get(const std::string &ansi_filepath);
+
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        lru_.clear();
+        entries_.clear();
+        size_ = 0;
+    }
+
+private:
+    using LruList = std::list<std::pair<std::string, DataFile>>;
+
+    LruList lru_; // most recently used at the front
+    std::unordered_map<std::string, LruList::iterator> entries_;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    size_t max_file_size_ = 0;
+    std::mutex mutex_;
+
+    // must be called with "mutex_" locked
+    void evict(const size_t room_needed);
+};
@@ -1,11 +1,134 @@
 #include "./http_service_class.h"
 #include "./service_impl_common.h"
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "utils/compression.h"
+#include "utils/json_backend.h"
+
 using namespace std;
 using HttpServer = SimpleWeb::Server<SimpleWeb::HTTP>;
 
 extern ApiHandlerMap api_handlers; // defined in handlers.cpp
 
+/**
+ * Return the text itself if it's short enough to be logged, or a description of its size.
+ */
+static string loggable(const string_view &text) {
+    static const size_t MAX_LOGGABLE_SIZE = 4096;
+    if (text.size() <= MAX_LOGGABLE_SIZE) {
+        return string(text);
+    }
+    return to_string(text.size()) + u8" ֽڵ";
+}
+
+/**
+ * Format a time as an HTTP-date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+static string http_date(const time_t time) {
+    const auto pt = boost::posix_time::from_time_t(time);
+    const auto date = pt.date();
+    const auto tod = pt.time_of_day();
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             date.day_of_week().as_short_string(), static_cast<int>(date.day()),
+             date.month().as_short_string(), static_cast<int>(date.year()),
+             static_cast<int>(tod.hours()), static_cast<int>(tod.minutes()), static_cast<int>(tod.seconds()));
+    return buf;
+}
+
+/**
+ * Parse an HTTP-date in any of the three formats of RFC 7231 section 7.1.1.1, e.g. "Sun, 06 Nov 1994 08:49:37 GMT",
+ * "Sunday, 06-Nov-94 08:49:37 GMT" or "Sun Nov  6 08:49:37 1994".
+ * \return nullopt if the date is invalid
+ */
+static optional<time_t> parse_http_date(const string &date) {
+    static const char *MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    char month_name[4] = {};
+    int day, year, hours, minutes, seconds;
+    if (sscanf(date.c_str(), "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+               &day, month_name, &year, &hours, &minutes, &seconds) == 6) {
+        // IMF-fixdate
+    } else if (sscanf(date.c_str(), "%*[A-Za-z], %2d-%3s-%2d %2d:%2d:%2d GMT",
+                      &day, month_name, &year, &hours, &minutes, &seconds) == 6) {
+        // obsolete RFC 850 format, with a two-digit year
+        year += year < 70 ? 2000 : 1900;
+    } else if (sscanf(date.c_str(), "%*3s %3s %2d %2d:%2d:%2d %4d",
+                      month_name, &day, &hours, &minutes, &seconds, &year) != 6) {
+        // nor ANSI C's asctime() format
+        return nullopt;
+    }
+
+    const auto month_it = find_if(begin(MONTHS), end(MONTHS),
+                                  [&month_name](const char *name) { return strcmp(name, month_name) == 0; });
+    if (month_it == end(MONTHS) || hours > 23 || minutes > 59 || seconds > 60) {
+        return nullopt;
+    }
+    try {
+        using namespace boost::posix_time;
+        const ptime pt(boost::gregorian::date(year, static_cast<unsigned short>(month_it - begin(MONTHS) + 1), day),
+                       time_duration(hours, minutes, seconds));
+        return static_cast<time_t>((pt - from_time_t(0)).total_seconds());
+    } catch (out_of_range &) {
+        return nullopt; // no such day
+    }
+}
+
+/**
+ * Parse a "Range" header field with a single byte range, e.g. "bytes=0-499", "bytes=500-" or "bytes=-500".
+ * \return the first and the last byte position (inclusive), nullopt if the field is invalid or has multiple ranges
+ * \throw std::out_of_range if the range is unsatisfiable
+ */
+static optional<pair<size_t, size_t>> parse_range(const string &range, const size_t size) {
+    if (!boost::starts_with(range, "bytes=") || range.find(',') != string::npos) {
+        return nullopt;
+    }
+    const auto spec = range.substr(strlen("bytes="));
+    const auto dash_pos = spec.find('-');
+    if (dash_pos == string::npos) {
+        return nullopt;
+    }
+
+    const auto first_str = boost::trim_copy(spec.substr(0, dash_pos));
+    const auto last_str = boost::trim_copy(spec.substr(dash_pos + 1));
+    const auto is_number = [](const string &str) {
+        return !str.empty() && all_of(str.begin(), str.end(), [](const char c) { return c >= '0' && c <= '9'; });
+    };
+
+    size_t first, last;
+    try {
+        if (first_str.empty()) {
+            // suffix range, the last N bytes
+            if (!is_number(last_str)) {
+                return nullopt;
+            }
+            const auto suffix_length = stoull(last_str);
+            if (suffix_length == 0) {
+                throw out_of_range("empty suffix range");
+            }
+            first = size > suffix_length ? size - static_cast<size_t>(suffix_length) : 0;
+            last = size - 1;
+        } else {
+            if (!is_number(first_str) || !last_str.empty() && !is_number(last_str)) {
+                return nullopt;
+            }
+            first = stoull(first_str);
+            last = last_str.empty() ? size - 1 : min(static_cast<size_t>(stoull(last_str)), size - 1);
+            if (last < first) {
+                return nullopt;
+            }
+        }
+    } catch (invalid_argument &) {
+        return nullopt;
+    }
+
+    if (size == 0 || first >= size) {
+        throw out_of_range("range not satisfiable");
+    }
+    return make_pair(first, last);
+}
+
 void HttpService::init() {
     Log::d(TAG, u8"ʼ HTTP");
 
@@ -19,8 +142,9 @@ void HttpService::init() {
             };
 
     for (const auto &handler_kv : api_handlers) {
-        const auto path_regex = "^/" + handler_kv.first + "/?$";
-        server_->resource[path_regex]["GET"] = server_->resource[path_regex]["POST"]
+        // API paths are matched exactly, which is much cheaper than trying a regex for each of them on every request
+        auto &path_resource = server_->exact_resource["/" + handler_kv.first];
+        path_resource["GET"] = path_resource["POST"]
                 = [&handler_kv](shared_ptr<HttpServer::Response> response,
                                 shared_ptr<HttpServer::Request> request) {
                     Log::d(TAG, u8"յ API " + request->method
@@ -46,14 +170,15 @@ void HttpService::init() {
                             Log::d(TAG, u8"Content-Type: " + content_type);
                         }
 
-                        auto body_string = request->content.string();
-                        Log::d(TAG, u8"HTTP ݣ" + body_string);
+                        // the body is parsed right from the request's buffer, it may be large (e.g. base64 images)
+                        const auto body = request->content.view();
+                        Log::d(TAG, u8"HTTP ݣ" + loggable(body));
 
                         if (boost::starts_with(content_type, "application/x-www-form-urlencoded")) {
-                            form = SimpleWeb::QueryString::parse(body_string);
+                            form = SimpleWeb::QueryString::parse(string(body));
                         } else if (boost::starts_with(content_type, "application/json")) {
                             try {
-                                json_params = json::parse(body_string); // may throw invalid_argument
+                                json_params = parse_json(body.data(), body.data() + body.size()); // may throw invalid_argument
                                 if (!json_params.is_object()) {
                                     throw invalid_argument("must be a JSON object");
                                 }
@@ -70,10 +195,10 @@ void HttpService::init() {
                     }
 
                     // merge form and args to json params
-                    for (auto data : {form, args}) {
-                        if (data.is_object()) {
-                            for (auto it = data.begin(); it != data.end(); ++it) {
-                                json_params[it.key()] = it.value();
+                    for (auto data : {&form, &args}) {
+                        if (data->is_object()) {
+                            for (auto it = data->begin(); it != data->end(); ++it) {
+                                json_params[it.key()] = move(it.value());
                             }
                         }
                     }
@@ -86,19 +211,39 @@ void HttpService::init() {
                     decltype(request->header) headers{
                         {"Content-Type", "application/json; charset=UTF-8"}
                     };
-                    auto resp_body = result.json().dump();
-                    Log::d(TAG, u8"Ӧ׼ϣ" + resp_body);
-                    response->write(resp_body, headers);
+                    auto resp_body = make_shared<string>(dump_json(move(result).json()));
+                    Log::d(TAG, u8"Ӧ׼ϣ" + loggable(*resp_body));
+                    if (config()->http_compression) {
+                        headers.emplace("Vary", "Accept-Encoding");
+                        const auto it = request->header.find("Accept-Encoding");
+                        if (const auto encoding = it != request->header.end()
+                                                      ? negotiate_content_encoding(it->second)
+                                                      : nullopt;
+                            encoding && resp_body->size() >= config()->http_compression_threshold) {
+                            try {
+                                *resp_body = compress(*resp_body, *encoding, config()->http_compression_level);
+                                headers.emplace("Content-Encoding", content_encoding_name(*encoding));
+                                Log::d(TAG, u8"ӦѹΪ " + to_string(resp_body->size()) + u8" ֽ");
+                            } catch (runtime_error &) {
+                                // send it uncompressed
+                            }
+                        }
+                    }
+                    // the body is sent straight from the string, instead of being copied into the response's buffer
+                    headers.emplace("Content-Length", to_string(resp_body->size()));
+                    response->write(headers);
+                    response->write_content(resp_body->data(), resp_body->size(), resp_body);
                     Log::d(TAG, u8"Ӧѷ");
                     Log::i(TAG, u8"ѳɹһ API " + request->path);
                 };
+        server_->exact_resource["/" + handler_kv.first + "/"] = path_resource;
     }
 
     // data files handler
     const auto regex = "^/(data/(?:bface|image|record|show)/.+)$";
-    server_->resource[regex]["GET"] = [](shared_ptr<HttpServer::Response> response,
-                                         shared_ptr<HttpServer::Request> request) {
-        if (!config.serve_data_files) {
+    server_->resource[regex]["GET"] = [this](shared_ptr<HttpServer::Response> response,
+                                             shared_ptr<HttpServer::Request> request) {
+        if (!config()->serve_data_files) {
             response->write(SimpleWeb::StatusCode::client_error_not_found);
             return;
         }
@@ -122,21 +267,71 @@ void HttpService::init() {
             return;
         }
 
-        if (ifstream f(ansi_filepath, ios::in | ios::binary); f.is_open()) {
-            auto length = fs::file_size(ansi_filepath);
-            response->write(decltype(request->header){
-                {"Content-Length", to_string(length)},
-                {"Content-Type", "application/octet-stream"},
-                {"Content-Disposition", "attachment"}
-            });
-            *response << f.rdbuf();
-            Log::d(TAG, u8"ļѷ");
-        } else {
+        DataFile file;
+        try {
+            file = data_file_cache_.get(ansi_filepath);
+        } catch (exception &) {
             Log::d(TAG, u8"ļ " + relpath + u8" ʧܣļϵͳȨ");
             response->write(SimpleWeb::StatusCode::client_error_forbidden);
             return;
         }
 
+        const auto last_modified = http_date(file.last_modified);
+        decltype(request->header) headers{
+            {"ETag", file.etag},
+            {"Last-Modified", last_modified}
+        };
+
+        // the client has a fresh copy already
+        auto not_modified = false;
+        if (const auto it = request->header.find("If-None-Match"); it != request->header.end()) {
+            vector<string> etags;
+            boost::split(etags, it->second, boost::is_any_of(","));
+            not_modified = any_of(etags.begin(), etags.end(), [&file](const string &etag) {
+                const auto trimmed = boost::trim_copy(etag);
+                return trimmed == "*" || trimmed == file.etag || trimmed == "W/" + file.etag;
+            });
+        } else if (const auto it = request->header.find("If-Modified-Since"); it != request->header.end()) {
+            const auto since = parse_http_date(it->second);
+            not_modified = since && file.last_modified <= *since;
+        }
+        if (not_modified) {
+            Log::d(TAG, u8"ļ " + relpath + u8" δ޸");
+            response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+            return;
+        }
+
+        headers.emplace("Content-Type", "application/octet-stream");
+        headers.emplace("Content-Disposition", "attachment");
+        headers.emplace("Accept-Ranges", "bytes");
+
+        auto status_code = SimpleWeb::StatusCode::success_ok;
+        auto first = static_cast<size_t>(0);
+        auto length = file.size;
+        if (const auto range_it = request->header.find("Range"); range_it != request->header.end()) {
+            // a range request with a stale "If-Range" validator gets the whole file
+            const auto if_range_it = request->header.find("If-Range");
+            if (if_range_it == request->header.end()
+                || if_range_it->second == file.etag || if_range_it->second == last_modified) {
+                try {
+                    if (const auto range = parse_range(range_it->second, file.size)) {
+                        status_code = SimpleWeb::StatusCode::success_partial_content;
+                        first = range->first;
+                        length = range->second - range->first + 1;
+                        headers.emplace("Content-Range", "bytes " + to_string(range->first) + "-"
+                                        + to_string(range->second) + "/" + to_string(file.size));
+                    }
+                } catch (out_of_range &) {
+                    response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable,
+                                    {{"Content-Range", "bytes */" + to_string(file.size)}});
+                    return;
+                }
+            }
+        }
+
+        headers.emplace("Content-Length", to_string(length));
+        response->write(status_code, headers);
+        response->write_content(file.data + first, length, file.owner);
         Log::i(TAG, u8"ѳɹļ" + relpath);
     };
 
@@ -145,16 +340,19 @@ void HttpService::init() {
 
 void HttpService::finalize() {
     server_ = nullptr;
+    data_file_cache_.clear();
     ServiceBase::finalize();
 }
 
 void HttpService::start() {
-    if (config.use_http) {
+    const auto conf = config();
+    if (conf->use_http) {
         init();
 
         server_->config.thread_pool_size = server_thread_pool_size();
-        server_->config.address = config.host;
-        server_->config.port = config.port;
+        server_->config.address = conf->host;
+        server_->config.port = conf->port;
+        data_file_cache_.configure(conf->data_file_cache_size, conf->data_file_cache_max_file_size);
         thread_ = thread([&]() {
             started_ = true;
             try {
@@ -183,7 +381,7 @@ bool HttpService::heartbeat() const {
 }
 
 bool HttpService::good() const {
-    if (config.use_http) {
+    if (config()->use_http) {
         return initialized_ && started_;
     }
     return ServiceBase::good();
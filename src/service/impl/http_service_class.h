@@ -2,6 +2,7 @@
 
 #include "../service_base_class.h"
 #include "web_server/server_http.hpp"
+#include "./data_file_cache_class.h"
 
 class HttpService final : public ServiceBase {
 public:
@@ -17,4 +18,5 @@ protected:
 private:
     std::shared_ptr<SimpleWeb::Server<SimpleWeb::HTTP>> server_;
     std::thread thread_;
+    DataFileCache data_file_cache_;
 };
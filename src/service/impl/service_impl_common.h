@@ -5,6 +5,8 @@
 #include <boost/filesystem.hpp>
 
 #include "api/api.h"
+#include "utils/json_backend.h"
+#include "utils/json_payload_class.h"
 #include "web_server/utility.hpp"
 
 namespace fs = boost::filesystem;
@@ -17,7 +19,7 @@ static const auto TAG = u8"API
  */
 static bool authorize(const SimpleWeb::CaseInsensitiveMultimap &headers, const json &query_args,
                       const std::function<void(SimpleWeb::StatusCode)> on_failed = nullptr) {
-    if (config.access_token.empty()) {
+    if (config()->access_token.empty()) {
         return true;
     }
 
@@ -37,7 +39,7 @@ static bool authorize(const SimpleWeb::CaseInsensitiveMultimap &headers, const j
         return false;
     }
 
-    if (token_given != config.access_token) {
+    if (token_given != config()->access_token) {
         if (on_failed) {
             on_failed(SimpleWeb::StatusCode::client_error_forbidden);
         }
@@ -48,69 +50,173 @@ static bool authorize(const SimpleWeb::CaseInsensitiveMultimap &headers, const j
 }
 
 static auto server_thread_pool_size() {
-    return config.server_thread_pool_size > 0
-               ? config.server_thread_pool_size
+    return config()->server_thread_pool_size > 0
+               ? config()->server_thread_pool_size
                : std::thread::hardware_concurrency() * 2 + 1;
 }
 
 /**
- * \brief Common "on_message" callback for websocket server's api endpoint and reverse websocket api client.
+ * Encoding of the messages on a websocket connection, negotiated through Sec-WebSocket-Protocol.
+ * JSON is sent in text frames, MessagePack and CBOR in binary frames.
+ */
+enum class WsEncoding { JSON, MSGPACK, CBOR };
+
+/**
+ * Subprotocols a websocket client may offer to receive binary encoded messages.
+ */
+static const std::vector<std::string> WS_BINARY_SUBPROTOCOLS = {"msgpack", "cbor"};
+
+static WsEncoding ws_encoding(const std::string &subprotocol) {
+    if (subprotocol == "msgpack") {
+        return WsEncoding::MSGPACK;
+    }
+    if (subprotocol == "cbor") {
+        return WsEncoding::CBOR;
+    }
+    return WsEncoding::JSON;
+}
+
+/**
+ * \brief Encode a JSON value as the payload of a websocket message.
+ * \return the payload, and the "fin_rsv_opcode" of the frame to send it in
+ */
+static std::pair<std::string, unsigned char> ws_encode(const json &value, const WsEncoding encoding) {
+    switch (encoding) {
+    case WsEncoding::MSGPACK: {
+        const auto bytes = json::to_msgpack(value);
+        return {std::string(bytes.begin(), bytes.end()), 130}; // 130=one fragment, binary
+    }
+    case WsEncoding::CBOR: {
+        const auto bytes = json::to_cbor(value);
+        return {std::string(bytes.begin(), bytes.end()), 130};
+    }
+    default:
+        return {dump_json(value), 129}; // 129=one fragment, text
+    }
+}
+
+/**
+ * \brief Encode a shared payload, reusing the serialized form if another connection or service has built it.
+ * \return the payload, valid as long as "payload" is, and the "fin_rsv_opcode" of the frame to send it in
+ */
+static std::pair<const std::string &, unsigned char> ws_encode(const JsonPayload &payload,
+                                                               const WsEncoding encoding) {
+    switch (encoding) {
+    case WsEncoding::MSGPACK:
+        return {payload.msgpack(), 130};
+    case WsEncoding::CBOR:
+        return {payload.cbor(), 130};
+    default:
+        return {payload.dump(), 129};
+    }
+}
+
+/**
+ * \brief Decode the payload of a websocket message.
+ * Text frames are always parsed as JSON, so a client that negotiated a binary encoding may still send JSON.
+ * \throw std::exception if the payload is invalid
+ */
+static json ws_decode(const std::string &payload, const bool binary, const WsEncoding encoding) {
+    if (!binary || encoding == WsEncoding::JSON) {
+        return parse_json(payload);
+    }
+    const std::vector<uint8_t> bytes(payload.begin(), payload.end());
+    return encoding == WsEncoding::MSGPACK ? json::from_msgpack(bytes) : json::from_cbor(bytes);
+}
+
+/**
+ * Run an API call (the "task") elsewhere than on the thread reading the connection, for example in the worker pool.
+ */
+using WsApiDispatch = std::function<void(std::function<void()> task)>;
+
+template <typename WsT>
+static void ws_api_send_result(const std::shared_ptr<typename WsT::Connection> &connection, const WsEncoding encoding,
+                               ApiResult &&result, json echo = nullptr) {
+    auto resp_json = std::move(result).json();
+    if (!echo.is_null()) {
+        resp_json["echo"] = std::move(echo);
+    }
+    const auto resp = ws_encode(resp_json, encoding);
+    Log::d(TAG, u8"Ӧ׼ϣ" + (resp.second == 130
+                                                 ? std::to_string(resp.first.size()) + u8" ֽڶ"
+                                                 : resp.first));
+    auto send_stream = std::make_shared<typename WsT::SendStream>();
+    send_stream->write(resp.first.data(), resp.first.size());
+    connection->send(send_stream, nullptr, resp.second);
+    Log::d(TAG, u8"Ӧѷ");
+}
+
+/**
+ * \brief Handle an API call received on a websocket connection.
  * \tparam WsT WsServer (websocket server /api/ endpoint) or WsClient (reverse websocket api client)
+ * \param dispatch if given, the API is invoked through it, so the responses may be sent out of order,
+ * otherwise it is invoked on the calling thread
  */
 template <typename WsT>
-static void ws_api_on_message(std::shared_ptr<typename WsT::Connection> connection,
-                              std::shared_ptr<typename WsT::Message> message) {
+static void ws_api_handle_message(const std::shared_ptr<typename WsT::Connection> &connection,
+                                  const std::shared_ptr<typename WsT::Message> &message,
+                                  const WsApiDispatch &dispatch) {
+    const auto encoding = ws_encoding(connection->protocol);
+    const auto binary = (message->fin_rsv_opcode & 0x0f) == 2;
     auto ws_message_str = message->string();
-    Log::d(TAG, u8"յ API WebSocket" + ws_message_str);
-
-    ApiResult result;
-
-    auto send_result = [&connection, &result](const json &echo = nullptr) {
-        auto resp_json = result.json();
-        if (!echo.is_null()) {
-            resp_json["echo"] = echo;
-        }
-        auto resp_body = resp_json.dump();
-        Log::d(TAG, u8"Ӧ׼ϣ" + resp_body);
-        auto send_stream = std::make_shared<typename WsT::SendStream>();
-        *send_stream << resp_body;
-        connection->send(send_stream);
-        Log::d(TAG, u8"Ӧѷ");
-    };
+    Log::d(TAG, u8"յ API WebSocket" + (binary
+                                                      ? std::to_string(ws_message_str.size()) + u8" ֽڶ"
+                                                      : ws_message_str));
 
     json payload;
     try {
-        payload = json::parse(ws_message_str);
-    } catch (std::invalid_argument &) {
-        // bad JSON
+        payload = ws_decode(ws_message_str, binary, encoding);
+    } catch (std::exception &) {
+        // bad JSON, MessagePack or CBOR
     }
     if (!(payload.is_object() && payload.find("action") != payload.end() && payload["action"].is_string())) {
-        Log::d(TAG, u8"Ϣе JSON Ч߲Ƕ");
+        Log::d(TAG, u8"ϢеЧ߲Ƕ");
+        ApiResult result;
         result.retcode = ApiResult::RetCodes::HTTP_BAD_REQUEST;
-        send_result();
+        ws_api_send_result<WsT>(connection, encoding, std::move(result));
         return;
     }
 
-    const auto action = payload["action"].get<std::string>();
+    auto action = payload["action"].get<std::string>();
 
     auto json_params = json::object();
-    if (payload.find("params") != payload.end() && payload["params"].is_object()) {
-        json_params = payload["params"];
+    if (const auto it = payload.find("params"); it != payload.end() && it->is_object()) {
+        json_params = std::move(*it);
     }
-    const Params params(move(json_params));
+    Params params(std::move(json_params));
 
-    try {
-        invoke_api(action, params, result);
-        Log::d(TAG, u8"ҵ API  " + action + u8"ѳɹ");
-    } catch (std::invalid_argument &) {
-        Log::d(TAG, u8"δҵ API  " + action);
-        result.retcode = ApiResult::RetCodes::HTTP_NOT_FOUND;
+    json echo;
+    if (const auto it = payload.find("echo"); it != payload.end()) {
+        echo = std::move(*it);
     }
 
-    json echo;
-    try {
-        echo = payload.at("echo");
-    } catch (...) {}
+    auto task = [connection, encoding, action = std::move(action), params = std::move(params),
+            echo = std::move(echo)]() mutable {
+        ApiResult result;
+        try {
+            invoke_api(action, params, result);
+            Log::d(TAG, u8"ҵ API  " + action + u8"ѳɹ");
+        } catch (std::invalid_argument &) {
+            Log::d(TAG, u8"δҵ API  " + action);
+            result.retcode = ApiResult::RetCodes::HTTP_NOT_FOUND;
+        }
+        ws_api_send_result<WsT>(connection, encoding, std::move(result), std::move(echo));
+    };
+
+    if (dispatch) {
+        dispatch(std::move(task));
+    } else {
+        task();
+    }
+}
 
-    send_result(echo);
+/**
+ * \brief Common "on_message" callback for websocket server's api endpoint and reverse websocket api client,
+ * which invokes the API on the thread reading the connection.
+ * \tparam WsT WsServer (websocket server /api/ endpoint) or WsClient (reverse websocket api client)
+ */
+template <typename WsT>
+static void ws_api_on_message(std::shared_ptr<typename WsT::Connection> connection,
+                              std::shared_ptr<typename WsT::Message> message) {
+    ws_api_handle_message<WsT>(connection, message, nullptr);
 }
@@ -5,26 +5,209 @@ using namespace std;
 using WsClient = SimpleWeb::SocketClient<SimpleWeb::WS>;
 using WssClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
 
+/**
+ * Split a url option, which may list several urls separated by commas.
+ */
+static vector<string> split_urls(const string &urls) {
+    vector<string> parts, result;
+    boost::split(parts, urls, boost::is_any_of(","));
+    for (auto &part : parts) {
+        boost::trim(part);
+        if (!part.empty()) {
+            result.push_back(move(part));
+        }
+    }
+    return result;
+}
+
+/**
+ * The conversation an event belongs to, which decides its target when balancing events by hash,
+ * so that the events of a conversation all go to the same server, in order.
+ */
+static optional<int64_t> conversation_of(const json &event) {
+    for (const auto key : {"group_id", "discuss_id", "user_id"}) {
+        if (const auto it = event.find(key); it != event.end() && it->is_number_integer()) {
+            return it->get<int64_t>();
+        }
+    }
+    return nullopt;
+}
+
+WsReverseService::WsReverseService() {
+    // the sub services are named after their role, numbered if there are several
+    const auto add = [this](auto sub_service) {
+        const auto raw = sub_service.get();
+        sub_services_.push_back(move(sub_service));
+        return raw;
+    };
+    if (config()->ws_reverse_use_universal_client) {
+        const auto count = max(config()->ws_reverse_universal_client_count, static_cast<size_t>(1));
+        size_t n = 0;
+        for (const auto &url : split_urls(config()->ws_reverse_url)) {
+            for (size_t i = 0; i < count; i++, n++) {
+                const auto universal = add(make_unique<UniversalSubService>(
+                    *this, n == 0 ? "Universal" : "Universal #" + to_string(n + 1), url));
+                if (i == 0) {
+                    event_targets_.push_back(universal);
+                }
+            }
+        }
+    } else {
+        size_t n = 0;
+        for (const auto &url : split_urls(config()->ws_reverse_api_url)) {
+            add(make_unique<ApiSubService>(n == 0 ? "API" : "API #" + to_string(n + 1), url));
+            n++;
+        }
+        n = 0;
+        for (const auto &url : split_urls(config()->ws_reverse_event_url)) {
+            event_targets_.push_back(
+                add(make_unique<EventSubService>(*this, n == 0 ? "Event" : "Event #" + to_string(n + 1), url)));
+            n++;
+        }
+    }
+}
+
+void WsReverseService::start() {
+    outbox_ = nullptr;
+    if (config()->use_event_outbox && !event_targets_.empty()) {
+        outbox_ = make_unique<Outbox>(
+            u8" WebSocket",
+            sdk->directories().app() + "outbox\\" + to_string(sdk->get_login_qq()) + "\\ws_reverse\\",
+            [this](const string &payload) {
+                json value;
+                try {
+                    value = parse_json(payload);
+                } catch (invalid_argument &) {
+                    return true; // it will never be delivered, so just drop it
+                }
+                return send_event(JsonPayload(move(value)));
+            });
+    }
+
+    for (auto &sub_service : sub_services_) {
+        sub_service->start();
+    }
+
+    if (outbox_ && any_of(event_targets_.cbegin(), event_targets_.cend(),
+                          [](const EventSubService *target) { return target->started(); })) {
+        outbox_->start();
+    }
+}
+
+void WsReverseService::stop() {
+    if (outbox_) {
+        outbox_->stop();
+    }
+    for (auto &sub_service : sub_services_) {
+        sub_service->stop();
+    }
+}
+
+bool WsReverseService::heartbeat() const {
+    for (const auto &sub_service : sub_services_) {
+        sub_service->heartbeat();
+    }
+    return true;
+}
+
+bool WsReverseService::initialized() const {
+    return all_of(sub_services_.cbegin(), sub_services_.cend(), [](const auto &s) { return s->initialized(); });
+}
+
+bool WsReverseService::started() const {
+    return all_of(sub_services_.cbegin(), sub_services_.cend(), [](const auto &s) { return s->started(); });
+}
+
+bool WsReverseService::good() const {
+    return all_of(sub_services_.cbegin(), sub_services_.cend(), [](const auto &s) { return s->good(); });
+}
+
+void WsReverseService::push_event(const JsonPayload &payload) const {
+    if (none_of(event_targets_.cbegin(), event_targets_.cend(),
+                [](const EventSubService *target) { return target->started(); })) {
+        return;
+    }
+
+    if (outbox_ && !outbox_->empty()) {
+        // earlier events are still waiting to be retried, this one must not overtake them
+        Log::d(TAG, u8"еȴͶݵ¼¼ѽ뷴 WebSocket ϱԶ");
+        outbox_->push(payload.dump());
+        return;
+    }
+
+    Log::d(TAG, u8"ʼͨ WebSocket ͻϱ¼");
+    if (!send_event(payload)) {
+        Log::d(TAG, u8"ͨ WebSocket ͻϱʧܣûпõ");
+        if (outbox_) {
+            Log::d(TAG, u8"¼ѽ뷴 WebSocket ϱԶ");
+            outbox_->push(payload.dump());
+        }
+    }
+}
+
+bool WsReverseService::send_event(const JsonPayload &payload) const {
+    const auto count = event_targets_.size();
+    if (count == 0) {
+        return false;
+    }
+
+    size_t first;
+    if (const auto conversation = config()->ws_reverse_event_balance == "hash"
+                                      ? conversation_of(payload.value())
+                                      : nullopt) {
+        first = hash<int64_t>()(*conversation) % count;
+    } else {
+        first = next_event_target_++ % count;
+    }
+
+    // fail over to the next connected targets, in order
+    for (size_t i = 0; i < count; i++) {
+        const auto target = event_targets_[(first + i) % count];
+        if (target->connected() && target->send(payload)) {
+            Log::d(TAG, u8"ͨ WebSocket ͻϱݵ " + target->url() + u8" ɹ");
+            return true;
+        }
+    }
+    return false;
+}
+
 template <typename WsClientT>
 shared_ptr<WsClientT> WsReverseService::SubServiceBase::init_ws_reverse_client(const string &server_port_path) {
     auto client = make_shared<WsClientT>(server_port_path);
+    const auto conf = config();
+    client->io_service = io_service_;
     client->config.header.emplace("User-Agent", CQAPP_USER_AGENT);
-    if (!config.access_token.empty()) {
-        client->config.header.emplace("Authorization", "Token " + config.access_token);
+    client->config.header.emplace("X-Client-Role", role());
+    client->config.permessage_deflate = conf->ws_compression;
+    client->config.compression_level = conf->ws_compression_level;
+    client->config.no_context_takeover = conf->ws_compression_no_context_takeover;
+    client->config.compression_threshold = conf->ws_compression_threshold;
+    client->config.max_inflated_message_size = conf->ws_compression_max_message_size;
+    if (ws_encoding(conf->ws_reverse_encoding) != WsEncoding::JSON) {
+        // the server accepts the binary encoding by echoing the subprotocol, otherwise we fall back to JSON
+        client->config.header.emplace("Sec-WebSocket-Protocol", conf->ws_reverse_encoding);
     }
+    client->on_open = [&](shared_ptr<typename WsClientT::Connection> connection) {
+        reconnect_attempts_ = 0;
+        connected_ = true;
+        if (api_dispatcher_) {
+            // the responses to the calls left from the last connection could not be sent anyway,
+            // those already running still count towards "ws_reverse_api_max_in_flight" until they finish
+            api_dispatcher_->cancel();
+        }
+        on_connected();
+    };
     client->on_close = [&](shared_ptr<typename WsClientT::Connection> connection,
                            int code, string reason) {
-        if (config.ws_reverse_reconnect_on_code_1000 || code != 1000) {
-            with_unique_lock(should_reconnect_mutex_, [&]() {
-                should_reconnect_ = true;
-            });
+        connected_ = false;
+        if (config()->ws_reverse_reconnect_on_code_1000 || code != 1000) {
+            schedule_reconnect();
         }
     };
     client->on_error = [&](shared_ptr<typename WsClientT::Connection> connection,
                            const SimpleWeb::error_code &error_code) {
-        with_unique_lock(should_reconnect_mutex_, [&]() {
-            should_reconnect_ = true;
-        });
+        connected_ = false;
+        schedule_reconnect();
     };
     return client;
 }
@@ -32,6 +215,13 @@ shared_ptr<WsClientT> WsReverseService::SubServiceBase::init_ws_reverse_client(c
 void WsReverseService::SubServiceBase::init() {
     Log::d(TAG, u8"ʼ WebSocket" + name() + u8"");
 
+    io_service_ = make_shared<SimpleWeb::asio::io_service>();
+    io_service_work_ = make_unique<SimpleWeb::asio::io_service::work>(*io_service_);
+    reconnect_timer_ = make_unique<SimpleWeb::asio::steady_timer>(*io_service_);
+    heartbeat_timer_ = make_unique<SimpleWeb::asio::steady_timer>(*io_service_);
+    reconnect_pending_ = false;
+    reconnect_attempts_ = 0;
+
     auto ws_url = url();
 
     try {
@@ -51,72 +241,37 @@ void WsReverseService::SubServiceBase::init() {
 }
 
 void WsReverseService::SubServiceBase::finalize() {
+    connected_ = false;
+    if (api_dispatcher_) {
+        api_dispatcher_->cancel();
+        api_dispatcher_ = nullptr;
+    }
     client_.ws = nullptr;
     client_.wss = nullptr;
     client_is_wss_ = nullopt;
+    // timers must be destroyed before the io_service they are bound to
+    reconnect_timer_ = nullptr;
+    heartbeat_timer_ = nullptr;
+    io_service_work_ = nullptr;
+    io_service_ = nullptr;
     ServiceBase::finalize();
 }
 
 void WsReverseService::SubServiceBase::start() {
-    if (config.use_ws_reverse) {
+    if (config()->use_ws_reverse) {
         init();
 
-        reconnect_worker_thread_ = thread([&]() {
-            try {
-                set_reconnect_worker_running(true);
-                while (is_reconnect_worker_running()) {
-                    auto should_reconn = false;
-                    with_unique_lock(should_reconnect_mutex_, [&]() {
-                        should_reconn = should_reconnect_;
-                        should_reconnect_ = false;
-                    });
-                    if (should_reconn) {
-                        Log::w(TAG, u8" WebSocket" + name() + u8"ͻʧܻ쳣Ͽ "
-                               + to_string(config.ws_reverse_reconnect_interval) + u8" ");
-                        Sleep(config.ws_reverse_reconnect_interval);
-                        stop();
-                        start();
-                    }
-
-                    if (is_reconnect_worker_running()) {
-                        Sleep(3000); // wait 3000 ms for the next check
-                    } else {
-                        break;
-                    }
-                }
-            } catch (...) {}
-        });
-
-        heartbeat_worker_thread_ = thread([&]() {
-            try {
-                set_heartbeat_worker_running(true);
-                while (is_heartbeat_worker_running()) {
-                    heartbeat();
-                    Log::d(TAG, u8" WebSocket" + name() + u8"ͻ˷ heartbeat ɹ");
-                    if (is_heartbeat_worker_running()) {
-                        Sleep(30000); // wait 30000 ms for the next check
-                    }
-                    else {
-                        break;
-                    }
-                }
-            }
-            catch (...) {}
-        });
-
         if (client_is_wss_.has_value()) {
             // client successfully initialized
+            io_service_->post([&]() { connect(); });
+            schedule_heartbeat();
+
+            started_ = true;
             thread_ = thread([&]() {
-                started_ = true;
                 try {
-                    if (client_is_wss_.value() == false) {
-                        client_.ws->start();
-                    } else {
-                        client_.wss->start();
-                    }
-                } catch (...) {
-                    started_ = false;
-                }
+                    io_service_->run();
+                } catch (...) {}
+                started_ = false;
             });
             Log::d(TAG, u8" WebSocket ͻˣ" + name() + u8"ɹʼ " + url());
         }
@@ -124,31 +279,107 @@ void WsReverseService::SubServiceBase::start() {
 }
 
 void WsReverseService::SubServiceBase::stop() {
-    // this will notify the reconnect worker to stop
-    set_reconnect_worker_running(false);
-    // detach but not join, because we want the thread continue to run until its next check
-    reconnect_worker_thread_.detach();
-
-    set_heartbeat_worker_running(false);
-    if (heartbeat_worker_thread_.joinable()) {
-        heartbeat_worker_thread_.join();
-    }
-
-    if (started_) {
+    if (client_is_wss_.has_value()) {
         if (client_is_wss_.value() == false) {
             client_.ws->stop();
         } else {
             client_.wss->stop();
         }
-        started_ = false;
+    }
+
+    if (io_service_) {
+        // pending timers are simply abandoned, so this never waits for a heartbeat or reconnect interval
+        io_service_work_ = nullptr;
+        io_service_->stop();
     }
     if (thread_.joinable()) {
         thread_.join();
     }
+    started_ = false;
+
+    if (api_dispatcher_) {
+        // the calls running in the worker pool send their results on the client,
+        // so they must finish before "finalize()" destroys it and its io_service
+        api_dispatcher_->cancel();
+        api_dispatcher_->wait();
+    }
 
     finalize();
 }
 
+/**
+ * Set the "Authorization" header from the current config, as "access_token" may be reloaded without restarting.
+ */
+static void set_authorization_header(SimpleWeb::CaseInsensitiveMultimap &header) {
+    header.erase("Authorization");
+    if (const auto access_token = config()->access_token; !access_token.empty()) {
+        header.emplace("Authorization", "Token " + access_token);
+    }
+}
+
+void WsReverseService::SubServiceBase::connect() {
+    try {
+        // the client uses our io_service, so "start()" only initiates an asynchronous connect
+        if (client_is_wss_.value() == false) {
+            set_authorization_header(client_.ws->config.header);
+            client_.ws->start();
+        } else {
+            set_authorization_header(client_.wss->config.header);
+            client_.wss->start();
+        }
+    } catch (...) {
+        schedule_reconnect();
+    }
+}
+
+void WsReverseService::SubServiceBase::schedule_reconnect() {
+    if (reconnect_pending_) {
+        // "on_error" and "on_close" may both be triggered by one disconnection
+        return;
+    }
+    reconnect_pending_ = true;
+
+    // exponential backoff, capped at "ws_reverse_reconnect_max_interval",
+    // plus up to 20% random jitter so that many clients won't reconnect at the same moment
+    const auto base_interval = max(config()->ws_reverse_reconnect_interval, 1ul);
+    const auto max_interval = max(config()->ws_reverse_reconnect_max_interval, base_interval);
+    auto interval = base_interval;
+    for (unsigned i = 0; i < reconnect_attempts_ && interval < max_interval; i++) {
+        interval *= 2;
+    }
+    interval = min(interval, max_interval);
+    interval += random_int(0, static_cast<unsigned>(interval / 5));
+    reconnect_attempts_++;
+
+    Log::w(TAG, u8" WebSocket" + name() + u8"ͻʧܻ쳣Ͽ "
+           + to_string(interval) + u8" ");
+
+    reconnect_timer_->expires_from_now(chrono::milliseconds(interval));
+    reconnect_timer_->async_wait([&](const SimpleWeb::error_code &ec) {
+        reconnect_pending_ = false;
+        if (!ec) {
+            connect();
+        }
+    });
+}
+
+void WsReverseService::SubServiceBase::schedule_heartbeat() {
+    // while heartbeats are off, check again later, as "ws_reverse_heartbeat_interval" may be reloaded
+    static const unsigned long DISABLED_CHECK_INTERVAL = 1000;
+
+    const auto interval = config()->ws_reverse_heartbeat_interval;
+    heartbeat_timer_->expires_from_now(chrono::milliseconds(interval > 0 ? interval : DISABLED_CHECK_INTERVAL));
+    heartbeat_timer_->async_wait([&, interval](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+            if (interval > 0) {
+                heartbeat();
+                Log::d(TAG, u8" WebSocket" + name() + u8"ͻ˷ heartbeat ɹ");
+            }
+            schedule_heartbeat();
+        }
+    });
+}
+
 bool WsReverseService::SubServiceBase::heartbeat() const {
     if (started_) {
         try {
@@ -156,14 +387,18 @@ bool WsReverseService::SubServiceBase::heartbeat() const {
                 const auto send_stream = make_shared<WsClient::SendStream>();
                 *send_stream << "_hb";
                 unique_lock<mutex> lock(client_.ws->connection_mutex);
-                client_.ws->connection->send(send_stream);
+                if (client_.ws->connection) {
+                    client_.ws->connection->send(send_stream);
+                }
                 lock.unlock();
             }
             else {
                 const auto send_stream = make_shared<WssClient::SendStream>();
                 *send_stream << "_hb";
                 unique_lock<mutex> lock(client_.wss->connection_mutex);
-                client_.wss->connection->send(send_stream);
+                if (client_.wss->connection) {
+                    client_.wss->connection->send(send_stream);
+                }
                 lock.unlock();
             }
         }
@@ -173,62 +408,133 @@ bool WsReverseService::SubServiceBase::heartbeat() const {
 }
 
 bool WsReverseService::SubServiceBase::good() const {
-    if (config.use_ws_reverse) {
+    if (config()->use_ws_reverse) {
         return initialized_ && started_;
     }
     return ServiceBase::good();
 }
 
-string WsReverseService::ApiSubService::url() {
-    return config.ws_reverse_api_url;
-}
-
-void WsReverseService::ApiSubService::init() {
-    SubServiceBase::init();
+void WsReverseService::SubServiceBase::serve_api() {
+    if (!client_is_wss_.has_value()) {
+        return;
+    }
 
-    if (client_is_wss_.has_value()) {
+    const auto max_in_flight = config()->ws_reverse_api_max_in_flight;
+    if (max_in_flight == 0) {
         if (client_is_wss_.value() == false) {
             client_.ws->on_message = ws_api_on_message<WsClient>;
         } else {
             client_.wss->on_message = ws_api_on_message<WssClient>;
         }
+        return;
+    }
+
+    api_dispatcher_ = make_shared<ApiDispatcher>(max_in_flight);
+    const auto dispatch = [this](function<void()> task) { api_dispatcher_->dispatch(move(task)); };
+    if (client_is_wss_.value() == false) {
+        client_.ws->on_message = [dispatch](shared_ptr<WsClient::Connection> connection,
+                                            shared_ptr<WsClient::Message> message) {
+            ws_api_handle_message<WsClient>(connection, message, dispatch);
+        };
+    } else {
+        client_.wss->on_message = [dispatch](shared_ptr<WssClient::Connection> connection,
+                                             shared_ptr<WssClient::Message> message) {
+            ws_api_handle_message<WssClient>(connection, message, dispatch);
+        };
     }
 }
 
-string WsReverseService::EventSubService::url() {
-    return config.ws_reverse_event_url;
+void WsReverseService::ApiDispatcher::dispatch(function<void()> task) {
+    if (!pool) {
+        task();
+        return;
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    if (in_flight_ >= max_in_flight_) {
+        pending_.push_back(move(task));
+        return;
+    }
+    in_flight_++;
+    lock.unlock();
+    run(move(task));
 }
 
-void WsReverseService::EventSubService::init() {
-    SubServiceBase::init();
+void WsReverseService::ApiDispatcher::cancel() {
+    unique_lock<mutex> lock(mutex_);
+    pending_.clear();
 }
 
-void WsReverseService::EventSubService::push_event(const json &payload) const {
-    if (started_) {
-        Log::d(TAG, u8"ʼͨ WebSocket ͻϱ¼");
+void WsReverseService::ApiDispatcher::wait() {
+    unique_lock<mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return in_flight_ == 0; });
+}
 
-        bool succeeded;
+void WsReverseService::ApiDispatcher::run(function<void()> task) {
+    auto self = shared_from_this();
+    pool->push([self, task](int) {
         try {
-            if (client_is_wss_.value() == false) {
-                const auto send_stream = make_shared<WsClient::SendStream>();
-                *send_stream << payload.dump();
-                // the WsClient class is modified by us ("connection" property made public),
-                // so we must maintain the lock manually
-                unique_lock<mutex> lock(client_.ws->connection_mutex);
-                client_.ws->connection->send(send_stream);
-                lock.unlock();
-            } else {
-                const auto send_stream = make_shared<WssClient::SendStream>();
-                *send_stream << payload.dump();
-                unique_lock<mutex> lock(client_.wss->connection_mutex);
-                client_.wss->connection->send(send_stream);
-                lock.unlock();
+            task();
+        } catch (...) {}
+
+        // take the next call waiting, if any, in place of this one
+        unique_lock<mutex> lock(self->mutex_);
+        if (self->pending_.empty()) {
+            if (--self->in_flight_ == 0) {
+                self->idle_.notify_all();
             }
-            succeeded = true;
-        } catch (...) {
-            succeeded = false;
+            return;
         }
+        auto next_task = move(self->pending_.front());
+        self->pending_.pop_front();
+        lock.unlock();
+        self->run(move(next_task));
+    });
+}
 
-        Log::d(TAG, u8"ͨ WebSocket ͻϱݵ " + config.ws_reverse_event_url + (succeeded ? u8" ɹ" : u8" ʧ"));
+void WsReverseService::ApiSubService::init() {
+    SubServiceBase::init();
+    serve_api();
+}
+
+void WsReverseService::EventSubService::on_connected() {
+    if (service_.outbox_) {
+        service_.outbox_->wake();
     }
 }
+
+bool WsReverseService::EventSubService::send(const JsonPayload &payload) const {
+    try {
+        if (client_is_wss_.value() == false) {
+            // the WsClient class is modified by us ("connection" property made public),
+            // so we must maintain the lock manually
+            unique_lock<mutex> lock(client_.ws->connection_mutex);
+            if (!client_.ws->connection) {
+                throw runtime_error("not connected");
+            }
+            const auto encoded = ws_encode(payload, ws_encoding(client_.ws->connection->protocol));
+            const auto send_stream = make_shared<WsClient::SendStream>();
+            send_stream->write(encoded.first.data(), encoded.first.size());
+            client_.ws->connection->send(send_stream, nullptr, encoded.second);
+            lock.unlock();
+        } else {
+            unique_lock<mutex> lock(client_.wss->connection_mutex);
+            if (!client_.wss->connection) {
+                throw runtime_error("not connected");
+            }
+            const auto encoded = ws_encode(payload, ws_encoding(client_.wss->connection->protocol));
+            const auto send_stream = make_shared<WssClient::SendStream>();
+            send_stream->write(encoded.first.data(), encoded.first.size());
+            client_.wss->connection->send(send_stream, nullptr, encoded.second);
+            lock.unlock();
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+void WsReverseService::UniversalSubService::init() {
+    SubServiceBase::init();
+    serve_api();
+}
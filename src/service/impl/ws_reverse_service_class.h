@@ -1,47 +1,85 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 #include "../service_base_class.h"
 #include "../pushable_interface.h"
+#include "event/outbox_class.h"
 #include "web_server/client_ws.hpp"
 #include "web_server/client_wss.hpp"
 
+/**
+ * Connects to each of the API and event urls with one client, or, if "ws_reverse_use_universal_client" is enabled,
+ * to each of the "ws_reverse_url" urls with "ws_reverse_universal_client_count" universal clients, which carry
+ * both API calls and events on the same connection. Only the first universal client of each url sends events,
+ * so they stay in order, and the others only serve API calls.
+ *
+ * The url options may list several servers, separated by commas, e.g. replicas of one bot backend.
+ * Each event is sent to one of the connected servers, chosen by "ws_reverse_event_balance",
+ * and to another one if that fails.
+ */
 class WsReverseService final : public ServiceBase, public IPushable {
 public:
-    void start() override {
-        api_.start();
-        event_.start();
-    }
+    WsReverseService();
 
-    void stop() override {
-        api_.stop();
-        event_.stop();
-    }
+    void start() override;
+    void stop() override;
+    bool heartbeat() const override;
+    bool initialized() const override;
+    bool started() const override;
+    bool good() const override;
+    void push_event(const JsonPayload &payload) const override;
 
-    bool heartbeat() const override {
-        return api_.heartbeat() && event_.heartbeat();
-    }
+private:
+    /**
+     * Runs the API calls received on one connection in the worker pool, at most "max_in_flight" at a time,
+     * while the others wait in the order they were received.
+     */
+    class ApiDispatcher : public std::enable_shared_from_this<ApiDispatcher> {
+    public:
+        explicit ApiDispatcher(const size_t max_in_flight) : max_in_flight_(max_in_flight) {}
 
-    bool initialized() const override {
-        return api_.initialized() && event_.initialized();
-    }
+        void dispatch(std::function<void()> task);
 
-    bool started() const override {
-        return api_.started() && event_.started();
-    }
+        /**
+         * Drop the calls still waiting, e.g. because the connection they came from is closed.
+         */
+        void cancel();
 
-    bool good() const override {
-        return api_.good() && event_.good();
-    }
+        /**
+         * Wait for the calls already running to finish, the caller must make sure no more are dispatched.
+         */
+        void wait();
 
-    void push_event(const json &payload) const override {
-        event_.push_event(payload);
-    }
+    private:
+        const size_t max_in_flight_;
+
+        std::mutex mutex_;
+        size_t in_flight_ = 0;
+        std::condition_variable idle_; // notified when "in_flight_" drops to 0
+        std::deque<std::function<void()>> pending_;
+
+        void run(std::function<void()> task);
+    };
 
-private:
     class SubServiceBase : public ServiceBase {
     public:
-        virtual std::string name() = 0;
-        virtual std::string url() = 0;
+        SubServiceBase(std::string name, std::string url) : name_(std::move(name)), url_(std::move(url)) {}
+
+        const std::string &name() const { return name_; }
+        const std::string &url() const { return url_; }
+
+        /**
+         * Whether the client is connected, i.e. it has opened and hasn't been closed or failed since.
+         */
+        bool connected() const { return connected_; }
+
+        /**
+         * Sent in the "X-Client-Role" header, so that a server may serve all kinds of clients on one endpoint.
+         */
+        virtual std::string role() const = 0;
 
         void start() override;
         void stop() override;
@@ -52,6 +90,17 @@ private:
         void init() override;
         void finalize() override;
 
+        /**
+         * Called on the io_service thread once the client has (re)connected.
+         */
+        virtual void on_connected() {}
+
+        /**
+         * Handle the messages received as API calls, must be called after "init()".
+         * If "ws_reverse_api_max_in_flight" is not 0, the calls are run concurrently in the worker pool.
+         */
+        void serve_api();
+
         union Client {
             std::shared_ptr<SimpleWeb::SocketClient<SimpleWeb::WS>> ws;
             std::shared_ptr<SimpleWeb::SocketClient<SimpleWeb::WSS>> wss;
@@ -65,63 +114,85 @@ private:
         std::thread thread_;
 
     private:
+        const std::string name_;
+        const std::string url_;
+        std::atomic_bool connected_{false};
+
         template <typename WsClientT>
         std::shared_ptr<WsClientT> init_ws_reverse_client(const std::string &server_port_path);
 
-        bool should_reconnect_ = false;
-        std::mutex should_reconnect_mutex_;
-        std::thread reconnect_worker_thread_;
-        bool reconnect_worker_running_ = false;
-        std::mutex reconnect_worker_running_mutex_;
+        void connect();
+        void schedule_reconnect();
+        void schedule_heartbeat();
 
-        bool is_reconnect_worker_running() {
-            std::unique_lock<std::mutex> lock(reconnect_worker_running_mutex_);
-            return reconnect_worker_running_;
-        }
-
-        void set_reconnect_worker_running(const bool yes_or_no) {
-            std::unique_lock<std::mutex> lock(reconnect_worker_running_mutex_);
-            reconnect_worker_running_ = yes_or_no;
-        }
+        // the client, the reconnect timer and the heartbeat timer all run on this io_service,
+        // driven by "thread_", so their handlers never run concurrently with each other
+        std::shared_ptr<SimpleWeb::asio::io_service> io_service_;
+        std::unique_ptr<SimpleWeb::asio::io_service::work> io_service_work_;
 
-        std::thread heartbeat_worker_thread_;
-        bool heartbeat_worker_running_ = false;
-        std::mutex heartbeat_worker_running_mutex_;
+        std::unique_ptr<SimpleWeb::asio::steady_timer> reconnect_timer_;
+        bool reconnect_pending_ = false;
+        unsigned reconnect_attempts_ = 0;
 
-        bool is_heartbeat_worker_running() {
-            std::unique_lock<std::mutex> lock(heartbeat_worker_running_mutex_);
-            return heartbeat_worker_running_;
-        }
+        std::unique_ptr<SimpleWeb::asio::steady_timer> heartbeat_timer_;
 
-        void set_heartbeat_worker_running(const bool yes_or_no) {
-            std::unique_lock<std::mutex> lock(heartbeat_worker_running_mutex_);
-            heartbeat_worker_running_ = yes_or_no;
-        }
+        // created by "serve_api()" and shared by all connections of the client,
+        // only used on the io_service thread, and by "stop()" once that thread has exited
+        std::shared_ptr<ApiDispatcher> api_dispatcher_;
     };
 
     class ApiSubService final : public SubServiceBase {
     public:
-        std::string name() override {
+        using SubServiceBase::SubServiceBase;
+
+        std::string role() const override {
             return "API";
         }
 
-        std::string url() override;
-
     protected:
         void init() override;
-    } api_;
+    };
 
-    class EventSubService final : public SubServiceBase, public IPushable {
+    class EventSubService : public SubServiceBase {
     public:
-        std::string name() override {
+        EventSubService(WsReverseService &service, std::string name, std::string url)
+            : SubServiceBase(std::move(name), std::move(url)), service_(service) {}
+
+        std::string role() const override {
             return "Event";
         }
 
-        std::string url() override;
+        bool send(const JsonPayload &payload) const;
+
+    protected:
+        void on_connected() override;
+
+    private:
+        WsReverseService &service_;
+    };
+
+    class UniversalSubService final : public EventSubService {
+    public:
+        using EventSubService::EventSubService;
 
-        void push_event(const json &payload) const override;
+        std::string role() const override {
+            return "Universal";
+        }
 
     protected:
         void init() override;
-    } event_;
+    };
+
+    std::vector<std::unique_ptr<SubServiceBase>> sub_services_;
+    std::vector<const EventSubService *> event_targets_; // the sub services that send events
+
+    // holds the events that couldn't be sent while disconnected, if "use_event_outbox" is enabled
+    std::unique_ptr<Outbox> outbox_;
+
+    mutable std::atomic<size_t> next_event_target_{0}; // for round robin
+
+    /**
+     * Send an event to one of the connected event targets, return false if none accepted it.
+     */
+    bool send_event(const JsonPayload &payload) const;
 };
@@ -4,47 +4,143 @@
 using namespace std;
 using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
 
+static bool ws_authorize(const shared_ptr<WsServer::Connection> &connection, const json &args) {
+    auto authorized = authorize(connection->header, args);
+    if (!authorized) {
+        Log::d(TAG, u8"ûṩ Token  Token ѹر");
+        auto send_stream = make_shared<WsServer::SendStream>();
+        *send_stream << "authorization failed";
+        connection->send(send_stream);
+        connection->send_close(1000); // we don't want this client any more
+    }
+    return authorized;
+}
+
 void WsService::init() {
     Log::d(TAG, u8"ʼ WebSocket");
 
-    auto on_open_callback = [](shared_ptr<WsServer::Connection> connection) {
-        Log::d(TAG, u8"յ WebSocket ӣ" + connection->path);
-        json args = SimpleWeb::QueryString::parse(connection->query_string);
-        auto authorized = authorize(connection->header, args);
-        if (!authorized) {
-            Log::d(TAG, u8"ûṩ Token  Token ѹر");
-            auto send_stream = make_shared<WsServer::SendStream>();
-            *send_stream << "authorization failed";
-            connection->send(send_stream);
-            connection->send_close(1000); // we don't want this client any more
-            return;
-        }
-    };
-
     server_ = make_shared<WsServer>();
 
     auto &api_endpoint = server_->endpoint["^/api/?$"];
-    api_endpoint.on_open = on_open_callback;
+    api_endpoint.on_open = [](shared_ptr<WsServer::Connection> connection) {
+        Log::d(TAG, u8"յ WebSocket ӣ" + connection->path);
+        ws_authorize(connection, SimpleWeb::QueryString::parse(connection->query_string));
+    };
     api_endpoint.on_message = ws_api_on_message<WsServer>;
 
     auto &event_endpoint = server_->endpoint["^/event/?$"];
-    event_endpoint.on_open = on_open_callback;
+    event_endpoint.on_open = [this](shared_ptr<WsServer::Connection> connection) {
+        Log::d(TAG, u8"յ WebSocket ӣ" + connection->path);
+        json args = SimpleWeb::QueryString::parse(connection->query_string);
+        if (!ws_authorize(connection, args)) {
+            return;
+        }
+        {
+            unique_lock<mutex> lock(authorized_event_connections_mutex_);
+            authorized_event_connections_.insert(connection);
+        }
+
+        // the client may give an event filter in the query string, e.g. "/event/?filter=%7B%22group_id%22%3A12345%7D"
+        json filter;
+        if (const auto it = args.find("filter"); it != args.end() && it->is_string()) {
+            try {
+                filter = json::parse(it->get<string>());
+            } catch (invalid_argument &) {
+                Log::d(TAG, u8"¼Ĺ˹Ч JSONѹر");
+                connection->send_close(1008, "invalid filter"); // 1008=policy violation
+                return;
+            }
+        }
+        try {
+            event_subscriptions_.subscribe(connection, filter);
+        } catch (exception &e) {
+            Log::d(TAG, string(u8"¼Ĺ˹﷨ѹرӣϢ") + e.what());
+            connection->send_close(1008, "invalid filter");
+        }
+    };
+    event_endpoint.on_message = [this](shared_ptr<WsServer::Connection> connection,
+                                       shared_ptr<WsServer::Message> message) {
+        {
+            // a client that failed authorization may ignore the close frame, but must not subscribe anyway
+            unique_lock<mutex> lock(authorized_event_connections_mutex_);
+            if (authorized_event_connections_.find(connection) == authorized_event_connections_.end()) {
+                lock.unlock();
+                connection->send_close(1008, "authorization failed");
+                return;
+            }
+        }
+
+        // the client may (re)subscribe by sending a filter as a message, at any time
+        const auto encoding = ws_encoding(connection->protocol);
+        ApiResult result;
+        try {
+            event_subscriptions_.subscribe(connection, ws_decode(message->string(),
+                                                                 (message->fin_rsv_opcode & 0x0f) == 2,
+                                                                 encoding));
+            Log::d(TAG, u8"WebSocket ͻѸ¼Ĺ˹");
+            result.retcode = ApiResult::RetCodes::OK;
+        } catch (exception &e) {
+            Log::d(TAG, string(u8"¼Ĺ˹ЧϢ") + e.what());
+            result.retcode = ApiResult::RetCodes::HTTP_BAD_REQUEST;
+        }
+        const auto resp = ws_encode(result.json(), encoding);
+        auto send_stream = make_shared<WsServer::SendStream>();
+        send_stream->write(resp.first.data(), resp.first.size());
+        connection->send(send_stream, nullptr, resp.second);
+    };
+    event_endpoint.on_close = [this](shared_ptr<WsServer::Connection> connection, int, const string &) {
+        forget_event_connection(connection);
+    };
+    event_endpoint.on_error = [this](shared_ptr<WsServer::Connection> connection, const SimpleWeb::error_code &) {
+        forget_event_connection(connection);
+    };
 
     ServiceBase::init();
 }
 
+void WsService::forget_event_connection(const EventConnection &connection) {
+    event_subscriptions_.unsubscribe(connection);
+    unique_lock<mutex> lock(authorized_event_connections_mutex_);
+    authorized_event_connections_.erase(connection);
+}
+
 void WsService::finalize() {
     server_ = nullptr;
+    event_subscriptions_.clear();
+    {
+        unique_lock<mutex> lock(authorized_event_connections_mutex_);
+        authorized_event_connections_.clear();
+    }
     ServiceBase::finalize();
 }
 
+static SimpleWeb::SendQueueOverflowPolicy send_queue_overflow_policy() {
+    if (config()->ws_send_queue_overflow_policy == "drop_newest") {
+        return SimpleWeb::SendQueueOverflowPolicy::drop_newest;
+    }
+    if (config()->ws_send_queue_overflow_policy == "disconnect") {
+        return SimpleWeb::SendQueueOverflowPolicy::disconnect;
+    }
+    return SimpleWeb::SendQueueOverflowPolicy::drop_oldest;
+}
+
 void WsService::start() {
-    if (config.use_ws) {
+    const auto conf = config();
+    if (conf->use_ws) {
         init();
 
         server_->config.thread_pool_size = server_thread_pool_size();
-        server_->config.address = config.ws_host;
-        server_->config.port = config.ws_port;
+        server_->config.address = conf->ws_host;
+        server_->config.port = conf->ws_port;
+        server_->config.subprotocols = WS_BINARY_SUBPROTOCOLS;
+        server_->config.send_queue_max_count = conf->ws_send_queue_max_count;
+        server_->config.send_queue_max_bytes = conf->ws_send_queue_max_bytes;
+        server_->config.send_queue_overflow_policy = send_queue_overflow_policy();
+        server_->config.permessage_deflate = conf->ws_compression;
+        server_->config.compression_level = conf->ws_compression_level;
+        server_->config.no_context_takeover = conf->ws_compression_no_context_takeover;
+        server_->config.compression_threshold = conf->ws_compression_threshold;
+        server_->config.max_inflated_message_size = conf->ws_compression_max_message_size;
         thread_ = thread([&]() {
             started_ = true;
             try {
@@ -73,28 +169,60 @@ bool WsService::heartbeat() const {
 }
 
 bool WsService::good() const {
-    if (config.use_ws) {
+    if (config()->use_ws) {
         return initialized_ && started_;
     }
     return ServiceBase::good();
 }
 
-void WsService::push_event(const json &payload) const {
+namespace {
+    /**
+     * What became of an event pushed to several connections, whose sends complete asynchronously.
+     * It is held by the send callbacks, and logged once the last of them is released, i.e. once every connection
+     * has written, dropped or discarded the event.
+     */
+    struct PushReport {
+        const size_t total_count;
+        atomic<size_t> sent_count{0};
+        atomic<size_t> dropped_count{0};
+
+        explicit PushReport(const size_t total_count) : total_count(total_count) {}
+
+        ~PushReport() {
+            Log::d(TAG, u8"ѳɹ " + to_string(sent_count.load()) + "/" + to_string(total_count) + u8"  WebSocket ͻ¼");
+            if (dropped_count > 0) {
+                Log::w(TAG, u8"ڿͻ˽չ" + to_string(dropped_count.load()) + u8" ͻ˵Ĵ¼ѱ");
+            }
+        }
+    };
+}
+
+void WsService::push_event(const JsonPayload &payload) const {
     if (started_) {
         Log::d(TAG, u8"ʼͨ WebSocket ¼");
-        size_t total_count = 0;
-        size_t succeeded_count = 0;
-        for (const auto &connection : server_->get_connections()) {
-            if (boost::algorithm::starts_with(connection->path, "/event")) {
-                total_count++;
-                try {
-                    const auto send_stream = make_shared<WsServer::SendStream>();
-                    *send_stream << payload.dump();
-                    connection->send(send_stream);
-                    succeeded_count++;
-                } catch (...) {}
-            }
+        const auto connections = event_subscriptions_.match(payload.value());
+        const auto report = make_shared<PushReport>(connections.size());
+        // the payload is encoded and copied into a send stream at most once for each encoding in use,
+        // and the stream is shared by the connections, since sending doesn't consume it
+        shared_ptr<WsServer::SendStream> send_streams[3];
+        for (const auto &connection : connections) {
+            try {
+                const auto encoding = ws_encoding(connection->protocol);
+                const auto encoded = ws_encode(payload, encoding);
+                auto &send_stream = send_streams[static_cast<size_t>(encoding)];
+                if (!send_stream) {
+                    send_stream = make_shared<WsServer::SendStream>();
+                    send_stream->write(encoded.first.data(), encoded.first.size());
+                }
+                connection->send(send_stream, [report](const SimpleWeb::error_code &ec) {
+                    if (!ec) {
+                        report->sent_count++;
+                    } else if (ec == SimpleWeb::asio::error::no_buffer_space) {
+                        // the client doesn't read fast enough, and its send queue is full
+                        report->dropped_count++;
+                    }
+                }, encoded.second);
+            } catch (...) {}
         }
-        Log::d(TAG, u8"ѳɹ " + to_string(succeeded_count) + "/" + to_string(total_count) + u8"  WebSocket ͻ¼");
     }
 }
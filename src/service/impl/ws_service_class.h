@@ -1,8 +1,12 @@
 #pragma once
 
+#include <mutex>
+#include <set>
+
 #include "../service_base_class.h"
 #include "../pushable_interface.h"
 #include "web_server/server_ws.hpp"
+#include "event/subscription_index_class.h"
 
 class WsService final : public ServiceBase, public IPushable {
 public:
@@ -11,13 +15,24 @@ public:
     bool heartbeat() const override;
     bool good() const override;
 
-    void push_event(const json &payload) const override;
+    void push_event(const JsonPayload &payload) const override;
 
 protected:
     void init() override;
     void finalize() override;
 
 private:
+    using EventConnection = std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>::Connection>;
+
+    void forget_event_connection(const EventConnection &connection);
+
     std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>> server_;
     std::thread thread_;
+
+    using EventSubscriptions = SubscriptionIndex<EventConnection>;
+    EventSubscriptions event_subscriptions_;
+
+    // the /event connections that passed authorization, the only ones allowed to subscribe
+    std::set<EventConnection> authorized_event_connections_;
+    std::mutex authorized_event_connections_mutex_;
 };
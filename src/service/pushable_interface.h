@@ -2,8 +2,10 @@
 
 #include "common.h"
 
+#include "utils/json_payload_class.h"
+
 class IPushable {
 public:
     virtual ~IPushable() = default;
-    virtual void push_event(const json &payload) const = 0;
+    virtual void push_event(const JsonPayload &payload) const = 0;
 };
@@ -31,14 +31,14 @@ using boost::algorithm::ends_with;
 namespace fs = boost::filesystem;
 
 static string update_source() {
-    if (ends_with(config.update_source, "/")) {
-        return config.update_source;
+    if (ends_with(config()->update_source, "/")) {
+        return config()->update_source;
     }
-    return config.update_source + "/";
+    return config()->update_source + "/";
 }
 
 static string latest_url() {
-    return update_source() + "latest/" + config.update_channel + ".json";
+    return update_source() + "latest/" + config()->update_channel + ".json";
 }
 
 static string version_info_url(const string &version, const int build_number) {
@@ -119,7 +119,7 @@ void check_update(const bool is_automatically) {
                             + (description.empty() ? u8"" : description)
                             + u8"\r\n\r\nǰ²Զ£ʹ Dockerȡ°汾 Docker ɾ app/io.github.richardchien.coolqhttpapi/app.lock");
             } else {
-                if (is_automatically && config.auto_perform_update) {
+                if (is_automatically && config()->auto_perform_update) {
                     // auto update
                     if (perform_update(version, build_number)) {
                         Log::i(TAG, u8"³ɹ Q Ч");
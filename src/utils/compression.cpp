@@ -0,0 +1,95 @@
+#include "./compression.h"
+
+#include <stdexcept>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <zlib.h>
+
+using namespace std;
+
+optional<ContentEncoding> negotiate_content_encoding(const string &accept_encoding) {
+    // e.g. "gzip, deflate;q=0.5, *;q=0"
+    optional<ContentEncoding> result;
+    auto result_q = 0.0;
+    auto wildcard_q = -1.0; // not given
+    auto gzip_refused = false, deflate_refused = false; // explicitly given q=0
+
+    vector<string> codings;
+    boost::split(codings, accept_encoding, boost::is_any_of(","));
+    for (const auto &coding : codings) {
+        vector<string> parts;
+        boost::split(parts, coding, boost::is_any_of(";"));
+        const auto name = boost::to_lower_copy(boost::trim_copy(parts[0]));
+
+        auto q = 1.0;
+        for (size_t i = 1; i < parts.size(); i++) {
+            const auto param = boost::trim_copy(parts[i]);
+            if (boost::istarts_with(param, "q=")) {
+                try {
+                    q = stod(param.substr(2));
+                } catch (exception &) {
+                    q = 0.0;
+                }
+            }
+        }
+
+        optional<ContentEncoding> encoding;
+        if (name == "gzip" || name == "x-gzip") {
+            encoding = ContentEncoding::GZIP;
+        } else if (name == "deflate") {
+            encoding = ContentEncoding::DEFLATE;
+        } else if (name == "*") {
+            wildcard_q = q;
+        }
+
+        if (encoding && q <= 0.0) {
+            (encoding == ContentEncoding::GZIP ? gzip_refused : deflate_refused) = true;
+        }
+
+        // on a tie, the one listed first wins, unless it is deflate and gzip comes later
+        if (encoding && q > 0.0
+            && (q > result_q || q == result_q && encoding == ContentEncoding::GZIP)) {
+            result = encoding;
+            result_q = q;
+        }
+    }
+
+    // the wildcard only stands for the codings not listed, so a refused one stays refused
+    if (!result && wildcard_q > 0.0) {
+        if (!gzip_refused) {
+            result = ContentEncoding::GZIP;
+        } else if (!deflate_refused) {
+            result = ContentEncoding::DEFLATE;
+        }
+    }
+    return result;
+}
+
+string content_encoding_name(const ContentEncoding encoding) {
+    return encoding == ContentEncoding::GZIP ? "gzip" : "deflate";
+}
+
+string compress(const string &data, const ContentEncoding encoding, const int level) {
+    z_stream stream{};
+    // window bits 15 gives a zlib stream ("deflate" in HTTP), adding 16 gives a gzip stream
+    const auto window_bits = encoding == ContentEncoding::GZIP ? 15 + 16 : 15;
+    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw runtime_error("failed to initialize zlib");
+    }
+
+    string out;
+    out.resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+
+    // deflateBound() guarantees the output fits, so one call finishes the stream
+    const auto ret = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (ret != Z_STREAM_END) {
+        throw runtime_error("failed to compress data");
+    }
+    return out;
+}
@@ -0,0 +1,44 @@
+// 
+// compression.h : Compress HTTP message bodies with zlib.
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+enum class ContentEncoding { GZIP, DEFLATE };
+
+/**
+ * Choose a content encoding from the value of an "Accept-Encoding" header field,
+ * preferring gzip to deflate if the client accepts both equally.
+ * \return nullopt if the client accepts neither
+ */
+std::optional<ContentEncoding> negotiate_content_encoding(const std::string &accept_encoding);
+
+/**
+ * Name of the content encoding, as used in "Content-Encoding" header field.
+ */
+std::string content_encoding_name(const ContentEncoding encoding);
+
+/**
+ * Compress data with the content encoding specified.
+ * \param level zlib compression level, 0-9 or -1 for zlib's default
+ * \throw std::runtime_error if zlib fails
+ */
+std::string compress(const std::string &data, const ContentEncoding encoding, const int level = -1);
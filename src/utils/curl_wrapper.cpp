@@ -21,84 +21,323 @@
 
 #include "app.h"
 
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <unordered_map>
 #include <curl/curl.h>
 
 using namespace std;
 
-curl::Response curl::Request::send() {
-    Response response;
+using curl::Request;
+using curl::Response;
 
-    const auto curl = curl_easy_init();
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+// a body larger than this is not reserved in advance, however large the "Content-Length" claims it is
+static const size_t MAX_RESERVED_BODY_SIZE = 16 * 1024 * 1024;
+
+// for the requests that follow redirects
+static const long MAX_REDIRECTS = 10;
+
+#if LIBCURL_VERSION_NUM < 0x074400
+// without curl_multi_poll() and curl_multi_wakeup(), new requests are picked up this often while others are in flight
+static const int ADD_INTERVAL = 10; // in milliseconds
+#endif
+
+namespace {
+    /**
+     * A request in flight, owning everything libcurl points to until it is done.
+     */
+    struct Transfer {
+        Request request;
+        Response response;
+        curl::ResponseCallback callback;
+        CURL *handle = nullptr;
+        curl_slist *header_list = nullptr;
+
+        ~Transfer() {
+            if (handle) {
+                curl_easy_cleanup(handle);
+            }
+            curl_slist_free_all(header_list);
+        }
+
+        void finish(const int curl_code) {
+            response.curl_code = curl_code;
+            if (curl_code == CURLE_OK) {
+                long status_code;
+                curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status_code);
+                response.status_code = static_cast<int>(status_code);
+                if (const auto it = response.headers.find("Content-Type"); it != response.headers.end()) {
+                    response.content_type = it->second;
+                }
+                if (const auto it = response.headers.find("Content-Length"); it != response.headers.end()) {
+                    try {
+                        response.content_length = size_t(stoll(it->second));
+                    } catch (logic_error &) {}
+                }
+            } else {
+                response.status_code = 0;
+            }
+
+            try {
+                callback(response);
+            } catch (...) {}
+        }
+    };
+
+    /**
+     * Drives all requests on one thread, through a multi handle of libcurl,
+     * so that they share the DNS cache, the connections and the TLS sessions.
+     */
+    class Engine {
+    public:
+        static Engine &instance() {
+            static Engine instance;
+            return instance;
+        }
+
+        ~Engine() { stop(); }
+
+        void add(unique_ptr<Transfer> transfer);
+        void stop();
+
+    private:
+        Engine() { curl_global_init(CURL_GLOBAL_DEFAULT); }
+
+        mutex mutex_;
+        condition_variable cv_;
+        deque<unique_ptr<Transfer>> pending_;
+        bool running_ = false;
+        uint64_t generation_ = 0; // increased on each stop, so that a stopping thread never picks up new requests
+        CURLM *multi_ = nullptr; // of the running thread
+        thread thread_;
+
+        void run(const uint64_t generation);
+        static bool start(CURLM *multi, CURLSH *share, Transfer &transfer);
+    };
+}
+
+void Engine::add(unique_ptr<Transfer> transfer) {
+    {
+        unique_lock<mutex> lock(mutex_);
+        pending_.push_back(move(transfer));
+        if (!running_) {
+            running_ = true;
+            thread_ = thread([this, generation = generation_] { run(generation); });
+        }
+#if LIBCURL_VERSION_NUM >= 0x074400
+        if (multi_) {
+            curl_multi_wakeup(multi_);
+        }
+#endif
+    }
+    cv_.notify_all();
+}
+
+void Engine::stop() {
+    deque<unique_ptr<Transfer>> pending;
+    thread driver;
+    {
+        unique_lock<mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        generation_++;
+        pending.swap(pending_);
+        driver = move(thread_);
+#if LIBCURL_VERSION_NUM >= 0x074400
+        if (multi_) {
+            curl_multi_wakeup(multi_);
+        }
+#endif
+    }
+    cv_.notify_all();
+    if (driver.joinable()) {
+        driver.join();
+    }
+
+    for (auto &transfer : pending) {
+        transfer->finish(CURLE_ABORTED_BY_CALLBACK);
+    }
+}
+
+bool Engine::start(CURLM *multi, CURLSH *share, Transfer &transfer) {
+    auto &request = transfer.request;
+
+    const auto curl = transfer.handle = curl_easy_init();
+    if (!curl) {
+        return false;
+    }
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, &transfer);
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L); // this is unsafe
 
-    if (method == Method::POST) {
+    if (request.method == curl::Method::POST) {
         curl_easy_setopt(curl, CURLOPT_POST, 1L);
     }
+    if (request.follow_location) {
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_MAXREDIRS, MAX_REDIRECTS);
+    }
 
-    auto header_cb = [](char *buf, size_t size, size_t count, void *headers) {
-        auto line = string(buf, count);
+    auto header_cb = [](char *buf, size_t size, size_t count, void *data) {
+        auto &transfer = *static_cast<Transfer *>(data);
+        auto line = string(buf, size * count);
+        if (boost::algorithm::starts_with(line, "HTTP/")) {
+            // the status line of a new response, e.g. after a redirect, whose headers replace the earlier ones
+            transfer.response.headers.clear();
+            return size * count;
+        }
         string k, v;
         const auto sep_pos = line.find(":");
         if (sep_pos != string::npos) {
             k = line.substr(0, sep_pos);
             v = line.substr(sep_pos + 1);
-            boost::algorithm::trim_left(v);
-            (*static_cast<Headers *>(headers))[k] = v;
+            boost::algorithm::trim(v);
+            if (transfer.request.write_data == &transfer.response.body
+                && _stricmp(k.c_str(), "Content-Length") == 0) {
+                // receive the body into a buffer of the right size, rather than growing it chunk by chunk
+                try {
+                    if (const auto length = size_t(stoll(v)); length <= MAX_RESERVED_BODY_SIZE) {
+                        transfer.response.body.reserve(length);
+                    }
+                } catch (logic_error &) {}
+            }
+            transfer.response.headers[k] = v;
         }
         return size * count;
     };
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response.headers);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, static_cast<WriteFunction>(header_cb));
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &transfer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, static_cast<curl::WriteFunction>(header_cb));
 
-    if (!write_func) {
-        write_data = &response.body;
-        write_func = [](char *buf, size_t size, size_t count, void *body) {
-            *static_cast<bytes *>(body) += string(buf, count);
+    if (!request.write_func) {
+        request.write_data = &transfer.response.body;
+        request.write_func = [](char *buf, size_t size, size_t count, void *body) {
+            static_cast<bytes *>(body)->append(buf, size * count);
             return size * count;
         };
     }
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, static_cast<WriteFunction>(write_func));
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, request.write_data);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, request.write_func);
 
-    if (!content_type.empty()) {
-        headers["Content-Type"] = content_type;
+    if (!request.content_type.empty()) {
+        request.headers["Content-Type"] = request.content_type;
     }
-    if (!user_agent.empty()) {
-        headers["User-Agent"] = user_agent;
+    if (!request.user_agent.empty()) {
+        request.headers["User-Agent"] = request.user_agent;
     }
 
-    struct curl_slist *chunk = nullptr;
-    for (const auto &header : headers) {
-        chunk = curl_slist_append(chunk, (header.first + ": " + header.second).c_str());
+    for (const auto &header : request.headers) {
+        transfer.header_list = curl_slist_append(transfer.header_list,
+                                                 (header.first + ": " + header.second).c_str());
     }
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, transfer.header_list);
 
-    if (body.size()) {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+    if (request.body.size()) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(request.body.size()));
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.data());
     }
 
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, request.connect_timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, request.timeout);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // or timeouts may use signals, which are not thread safe
+
+    return curl_multi_add_handle(multi, curl) == CURLM_OK;
+}
 
-    response.curl_code = curl_easy_perform(curl);
+void Engine::run(const uint64_t generation) {
+    const auto multi = curl_multi_init();
+    // the multi handle shares the connections of its transfers, and the share handle adds the DNS cache
+    // and the TLS sessions, all transfers are driven by this thread, so the shared data needs no locking
+    const auto share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
 
-    if (response.curl_code == CURLE_OK) {
-        long status_code;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status_code);
-        response.status_code = static_cast<int>(status_code);
-        if (response.headers.find("Content-Type") != response.headers.end()) {
-            response.content_type = response.headers["Content-Type"];
+    unordered_map<Transfer *, unique_ptr<Transfer>> active;
+
+    unique_lock<mutex> lock(mutex_);
+    multi_ = multi;
+    while (generation_ == generation) {
+        if (active.empty() && pending_.empty()) {
+            cv_.wait(lock, [&] { return generation_ != generation || !pending_.empty(); });
+            continue;
         }
-        if (response.headers.find("Content-Length") != response.headers.end()) {
-            response.content_length = size_t(stoll(response.headers["Content-Length"]));
+
+        deque<unique_ptr<Transfer>> added;
+        added.swap(pending_);
+        lock.unlock();
+
+        for (auto &transfer : added) {
+            if (start(multi, share, *transfer)) {
+                const auto key = transfer.get();
+                active.emplace(key, move(transfer));
+            } else {
+                transfer->finish(CURLE_FAILED_INIT);
+            }
         }
-    } else {
-        response.status_code = 0;
+
+        int running_count;
+        curl_multi_perform(multi, &running_count);
+
+        int message_count;
+        while (const auto message = curl_multi_info_read(multi, &message_count)) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            Transfer *key;
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, reinterpret_cast<char **>(&key));
+            const auto curl_code = message->data.result; // "message" is invalid once the handle is removed
+            curl_multi_remove_handle(multi, message->easy_handle);
+            if (const auto it = active.find(key); it != active.end()) {
+                const auto transfer = move(it->second);
+                active.erase(it);
+                transfer->finish(curl_code);
+            }
+        }
+
+        if (!active.empty()) {
+#if LIBCURL_VERSION_NUM >= 0x074400
+            curl_multi_poll(multi, nullptr, 0, 1000, nullptr); // woken up early by new requests or stop()
+#else
+            long timeout = -1;
+            curl_multi_timeout(multi, &timeout);
+            curl_multi_wait(multi, nullptr, 0, timeout >= 0 && timeout < ADD_INTERVAL ? timeout : ADD_INTERVAL,
+                            nullptr);
+#endif
+        }
+
+        lock.lock();
+    }
+    if (multi_ == multi) {
+        multi_ = nullptr;
     }
+    lock.unlock();
 
-    curl_slist_free_all(chunk);
-    curl_easy_cleanup(curl);
+    for (auto &entry : active) {
+        curl_multi_remove_handle(multi, entry.second->handle);
+        entry.second->finish(CURLE_ABORTED_BY_CALLBACK);
+    }
+    active.clear(); // the easy handles must be cleaned up before the share handle
+    curl_multi_cleanup(multi);
+    curl_share_cleanup(share);
+}
+
+void Request::send_async(curl::ResponseCallback callback) const {
+    auto transfer = make_unique<Transfer>();
+    transfer->request = *this;
+    transfer->callback = move(callback);
+    Engine::instance().add(move(transfer));
+}
+
+Response Request::send() {
+    promise<Response> done;
+    send_async([&done](Response &response) { done.set_value(move(response)); });
+    return done.get_future().get();
+}
 
-    return response;
+void curl::stop_engine() {
+    Engine::instance().stop();
 }
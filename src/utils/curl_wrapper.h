@@ -21,6 +21,7 @@
 
 #include "common.h"
 
+#include <functional>
 #include <map>
 
 namespace curl {
@@ -55,6 +56,8 @@ namespace curl {
         json json_;
     };
 
+    using ResponseCallback = std::function<void(Response &)>;
+
     enum class Method {
         GET,
         POST
@@ -69,8 +72,9 @@ namespace curl {
         bytes body;
         void *write_data = nullptr;
         WriteFunction write_func = nullptr;
-        long connect_timeout = 0;
-        long timeout = 0;
+        long connect_timeout = 0; // in milliseconds, 0 means the default of libcurl
+        long timeout = 0; // of the whole request, in milliseconds, 0 means no timeout
+        bool follow_location = false; // follow redirects, the response is that of the last request
 
         Request() {}
 
@@ -79,8 +83,20 @@ namespace curl {
 
         Request(const std::string &url, const Headers &headers) : url(url), headers(headers) {}
 
+        /**
+         * Make the request and wait for the response.
+         * Never call it from a "send_async" callback: the callback runs on the engine thread,
+         * which would then wait for a response that only itself can drive, forever.
+         */
         Response send();
 
+        /**
+         * Make the request without waiting, "callback" is called with the response on the thread of the engine
+         * that drives all requests, so it must not block, and in particular must not call "send()".
+         * The request is copied, but "write_data" is not, and must stay valid until "callback" is called.
+         */
+        void send_async(ResponseCallback callback) const;
+
         Response get() {
             method = Method::GET;
             return send();
@@ -91,4 +107,10 @@ namespace curl {
             return send();
         }
     };
+
+    /**
+     * Stop the engine that drives the requests, requests in flight fail with CURLE_ABORTED_BY_CALLBACK.
+     * The engine starts again on the next request.
+     */
+    void stop_engine();
 }
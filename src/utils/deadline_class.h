@@ -0,0 +1,107 @@
+// 
+// deadline_class.h : Define Deadline class,
+// which bounds the time spent in outbound requests made on behalf of an API call.
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+
+/**
+ * The time by which the work of the current thread (e.g. the API call it is handling) should be done.
+ * Outbound HTTP requests made on the thread are given at most the time left,
+ * and are not made at all once it has passed.
+ */
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Set the deadline of the current thread to "timeout" milliseconds from now, until the scope ends.
+     * A timeout of 0 leaves the deadline as it is. A nested scope never extends the deadline of an outer one.
+     */
+    class Scope {
+    public:
+        explicit Scope(const unsigned long timeout) : previous_(current()) {
+            if (timeout > 0) {
+                const auto deadline = Clock::now() + std::chrono::milliseconds(timeout);
+                if (!previous_ || deadline < *previous_) {
+                    current() = deadline;
+                }
+            }
+        }
+
+        /**
+         * Set the deadline of the current thread to one taken from another thread with get(), until the scope ends,
+         * e.g. in a task that continues the work of that thread. A nullopt deadline leaves the deadline as it is.
+         */
+        explicit Scope(const std::optional<Clock::time_point> &deadline) : previous_(current()) {
+            if (deadline && (!previous_ || *deadline < *previous_)) {
+                current() = *deadline;
+            }
+        }
+
+        ~Scope() { current() = previous_; }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const std::optional<Clock::time_point> previous_;
+    };
+
+    /**
+     * Get the deadline of the current thread, nullopt if there is none.
+     */
+    static std::optional<Clock::time_point> get() {
+        return current();
+    }
+
+    /**
+     * \brief Bound a timeout by the deadline of the current thread.
+     * \param timeout in milliseconds, 0 means no timeout
+     * \return the timeout to use (0 if still none), or nullopt if the deadline has passed
+     */
+    static std::optional<unsigned long> bound(const unsigned long timeout) {
+        const auto &deadline = current();
+        if (!deadline) {
+            return timeout;
+        }
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - Clock::now()).count();
+        if (left <= 0) {
+            return std::nullopt;
+        }
+        return timeout > 0 && timeout < static_cast<unsigned long>(left) ? timeout : static_cast<unsigned long>(left);
+    }
+
+    /**
+     * Whether the deadline of the current thread has passed.
+     */
+    static bool passed() {
+        const auto &deadline = current();
+        return deadline && Clock::now() >= *deadline;
+    }
+
+private:
+    static std::optional<Clock::time_point> &current() {
+        static thread_local std::optional<Clock::time_point> deadline;
+        return deadline;
+    }
+};
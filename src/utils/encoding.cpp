@@ -3,30 +3,79 @@
 #include "app.h"
 
 #include <iconv.h>
-#include <codecvt>
+#include <cerrno>
+#include <map>
 
 using namespace std;
 
-static shared_ptr<wchar_t> multibyte_to_widechar(const int code_page, const char *multibyte_str) {
-    const auto len = MultiByteToWideChar(code_page, 0, multibyte_str, -1, nullptr, 0);
-    auto c_wstr_sptr = make_shared_array<wchar_t>(len + 1);
-    MultiByteToWideChar(code_page, 0, multibyte_str, -1, c_wstr_sptr.get(), len);
-    return c_wstr_sptr;
+/**
+ * Check if the string only contains ASCII characters, 8 bytes at a time.
+ */
+static bool is_ascii(const string &s) {
+    const auto data = s.data();
+    const auto size = s.size();
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word)); // compiles to a single unaligned load
+        if (word & 0x8080808080808080ull) {
+            return false;
+        }
+    }
+    for (; i < size; i++) {
+        if (static_cast<unsigned char>(data[i]) & 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Check if ASCII characters are encoded the same in the encoding as in ASCII,
+ * so that a pure ASCII string needs no conversion.
+ */
+static bool is_ascii_compatible(const Encoding encoding) {
+    return encoding == Encodings::ANSI || encoding == Encodings::UTF8
+           || encoding == Encodings::GB2312 || encoding == Encodings::GB18030;
 }
 
-static shared_ptr<char> widechar_to_multibyte(const int code_page, const wchar_t *widechar_str) {
-    const auto len = WideCharToMultiByte(code_page, 0, widechar_str, -1, nullptr, 0, nullptr, nullptr);
-    auto c_str_sptr = make_shared_array<char>(len + 1);
-    WideCharToMultiByte(code_page, 0, widechar_str, -1, c_str_sptr.get(), len, nullptr, nullptr);
-    return c_str_sptr;
+static bool is_ascii_compatible(const string &encoding) {
+    for (const auto name : {"utf-8", "utf8", "gb18030", "gbk", "gb2312", "cp936"}) {
+        if (boost::algorithm::iequals(encoding, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static wstring multibyte_to_widechar(const Encoding code_page, const string &multibyte_str) {
+    if (multibyte_str.empty()) {
+        return wstring();
+    }
+    const auto size = static_cast<int>(multibyte_str.size());
+    const auto len = MultiByteToWideChar(code_page, 0, multibyte_str.data(), size, nullptr, 0);
+    wstring result(len, L'\0');
+    MultiByteToWideChar(code_page, 0, multibyte_str.data(), size, &result[0], len);
+    return result;
+}
+
+static string widechar_to_multibyte(const Encoding code_page, const wstring &widechar_str) {
+    if (widechar_str.empty()) {
+        return string();
+    }
+    const auto size = static_cast<int>(widechar_str.size());
+    const auto len = WideCharToMultiByte(code_page, 0, widechar_str.data(), size, nullptr, 0, nullptr, nullptr);
+    string result(len, '\0');
+    WideCharToMultiByte(code_page, 0, widechar_str.data(), size, &result[0], len, nullptr, nullptr);
+    return result;
 }
 
 string ws2s(const wstring &ws) {
-    return wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().to_bytes(ws);
+    return widechar_to_multibyte(Encodings::UTF8, ws);
 }
 
 wstring s2ws(const string &s) {
-    return wstring_convert<codecvt_utf8<wchar_t>, wchar_t>().from_bytes(s);
+    return multibyte_to_widechar(Encodings::UTF8, s);
 }
 
 string ansi(const string &s) {
@@ -34,39 +83,86 @@ string ansi(const string &s) {
 }
 
 bytes string_encode(const string &s, const Encoding encoding) {
-    return widechar_to_multibyte(encoding, s2ws(s).c_str()).get();
+    if (is_ascii_compatible(encoding) && is_ascii(s)) {
+        return s;
+    }
+    return widechar_to_multibyte(encoding, s2ws(s));
 }
 
 string string_decode(const bytes &b, const Encoding encoding) {
-    return ws2s(wstring(multibyte_to_widechar(encoding, b.c_str()).get()));
+    if (is_ascii_compatible(encoding) && is_ascii(b)) {
+        return b;
+    }
+    return ws2s(multibyte_to_widechar(encoding, b));
 }
 
-static bytes iconv_convert_encoding(const bytes &text, const string &from_enc, const string &to_enc,
-                                    const float capability_factor) {
-    bytes result;
+/**
+ * Get an iconv descriptor of the current thread, which is opened once and reused by later conversions.
+ * \return (iconv_t)-1 if the conversion is not supported
+ */
+static iconv_t iconv_descriptor(const string &from_enc, const string &to_enc) {
+    // iconv descriptors carry conversion state, so they can't be shared between threads
+    struct Descriptors {
+        map<pair<string, string>, iconv_t> cds;
+
+        ~Descriptors() {
+            for (const auto &entry : cds) {
+                iconv_close(entry.second);
+            }
+        }
+    };
+    thread_local Descriptors descriptors;
+
+    const auto key = make_pair(from_enc, to_enc);
+    if (const auto it = descriptors.cds.find(key); it != descriptors.cds.end()) {
+        // reset the state possibly left by an earlier failed conversion
+        iconv(it->second, nullptr, nullptr, nullptr, nullptr);
+        return it->second;
+    }
 
     const auto cd = iconv_open(to_enc.c_str(), from_enc.c_str());
-    auto in = const_cast<char *>(text.data());
-    auto in_bytes_left = text.size();
+    if (cd != reinterpret_cast<iconv_t>(-1)) {
+        descriptors.cds.emplace(key, cd);
+    }
+    return cd;
+}
 
-    if (in_bytes_left == 0) {
-        return result;
+static bytes iconv_convert_encoding(const bytes &text, const string &from_enc, const string &to_enc,
+                                    const float capability_factor) {
+    if (text.empty()) {
+        return bytes();
     }
 
-    auto out_bytes_left = static_cast<decltype(in_bytes_left)>(static_cast<double>(in_bytes_left) * capability_factor);
-    auto out = new char[out_bytes_left] {0};
-    const auto out_begin = out;
+    if (is_ascii_compatible(from_enc) && is_ascii_compatible(to_enc) && is_ascii(text)) {
+        return text;
+    }
 
-    try {
-        if (static_cast<size_t>(-1) != iconv(cd, &in, &in_bytes_left, &out, &out_bytes_left)) {
-            // successfully converted
-            result = out_begin;
-        }
-    } catch (...) {}
+    const auto cd = iconv_descriptor(from_enc, to_enc);
+    if (cd == reinterpret_cast<iconv_t>(-1)) {
+        return bytes();
+    }
 
-    delete[] out_begin;
-    iconv_close(cd);
+    auto in = const_cast<char *>(text.data());
+    auto in_bytes_left = text.size();
 
+    // "capability_factor" is only a hint for the initial size, the buffer grows as needed
+    bytes result;
+    result.resize(max(static_cast<size_t>(static_cast<double>(in_bytes_left) * capability_factor), size_t(16)));
+    size_t out_size = 0;
+    while (true) {
+        auto out = &result[out_size];
+        auto out_bytes_left = result.size() - out_size;
+        const auto ret = iconv(cd, &in, &in_bytes_left, &out, &out_bytes_left);
+        out_size = result.size() - out_bytes_left;
+        if (ret != static_cast<size_t>(-1)) {
+            break; // successfully converted
+        }
+        if (errno != E2BIG) {
+            return bytes(); // invalid or incomplete input
+        }
+        result.resize(result.size() * 2);
+    }
+    result.resize(out_size);
     return result;
 }
 
@@ -4,82 +4,33 @@
 
 #include <regex>
 #include <boost/filesystem.hpp>
-#include <cpprest/http_client.h>
-#undef U  // fix bug in cpprestsdk
 
 #include "utils/curl_wrapper.h"
+#include "utils/deadline_class.h"
+#include "utils/json_backend.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
 
-namespace http = web::http;
-using http::http_exception;
-using http::http_headers;
-using http::http_request;
-using http::http_response;
-
-using http::client::http_client;
-using http::client::http_client_config;
-
 #define FAKE_USER_AGENT "Mozilla/5.0 (Windows NT 10.0; Win64; x64) " \
     "AppleWebKit/537.36 (KHTML, like Gecko) " \
     "Chrome/56.0.2924.87 Safari/537.36"
 
-static optional<json> get_remote_json_cpprestsdk(const string &url, const bool use_fake_ua, const string &cookies) {
-    http_request request(http::methods::GET);
-    request.headers().add(L"User-Agent", s2ws(use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT));
-    request.headers().add(L"Referer", s2ws(url));
-    if (!cookies.empty()) {
-        request.headers().add(L"Cookie", s2ws(cookies));
-    }
-
-    auto task = http_client(s2ws(url))
-            .request(request)
-            .then([](pplx::task<http_response> task) {
-                auto next_task = pplx::task_from_result<string>("");
-                try {
-                    auto resp = task.get();
-                    if (resp.status_code() >= 200 && resp.status_code() < 300) {
-                        next_task = resp.extract_utf8string(true);
-                    }
-                } catch (http_exception &) {
-                    // failed to request
-                }
-                return next_task;
-            })
-            .then([](string &body) {
-                if (smatch m; regex_search(body, m, regex("\\);?\\s*$"))) {
-                    // is jsonp
-                    if (auto start = body.find("("); start != string::npos) {
-                        body = body.substr(start + 1, body.size() - (start + 1) - m.length());
-                    }
-                }
-                if (!body.empty()) {
-                    return pplx::task_from_result(make_optional<json>(json::parse(body)));
-                    // may throw invalid_argument due to invalid json
-                }
-                return pplx::task_from_result(optional<json>());
-            });
-
-    try {
-        return task.get();
-    } catch (invalid_argument &) {
-        return nullopt;
-    }
-}
-
-static optional<json> get_remote_json_libcurl(const string &url, const bool use_fake_ua, const string &cookies) {
+static optional<json> get_remote_json_libcurl(const string &url, const bool use_fake_ua, const string &cookies,
+                                              const unsigned long timeout) {
     auto request = curl::Request(url, curl::Headers{
         {"User-Agent", use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT},
         {"Referer", url}
     });
+    request.timeout = timeout;
+    request.follow_location = true;
     if (!cookies.empty()) {
         request.headers["Cookie"] = cookies;
     }
 
-    if (const auto response = request.get();
+    if (auto response = request.get();
         response.status_code >= 200 && response.status_code < 300) {
-        auto body = response.body;
+        auto &body = response.body;
         if (smatch m; regex_search(body, m, regex("\\);?\\s*$"))) {
             // is jsonp
             if (const auto start = body.find("("); start != string::npos) {
@@ -88,7 +39,7 @@ static optional<json> get_remote_json_libcurl(const string &url, const bool use_
         }
         if (!body.empty()) {
             try {
-                return json::parse(body);
+                return parse_json(body);
             } catch (invalid_argument &) {}
         }
     }
@@ -97,55 +48,15 @@ static optional<json> get_remote_json_libcurl(const string &url, const bool use_
 }
 
 optional<json> get_remote_json(const string &url, const bool use_fake_ua, const string &cookies) {
-    if (is_in_wine()) {
-        return get_remote_json_libcurl(url, use_fake_ua, cookies);
-    }
-    return get_remote_json_cpprestsdk(url, use_fake_ua, cookies);
-}
-
-static bool download_remote_file_cpprestsdk(const string &url, const string &local_path, const bool use_fake_ua) {
-    using concurrency::streams::container_buffer;
-
-    auto succeeded = false;
-
-    auto ansi_local_path = ansi(local_path);
-
-    http_request request(http::methods::GET);
-    request.headers().add(L"User-Agent", s2ws(use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT));
-    request.headers().add(L"Referer", s2ws(url));
-
-    http_client(s2ws(url)).request(request).then([&](http_response response) {
-        if (ofstream f(ansi_local_path, ios::out | ios::binary); f.is_open()) {
-            auto length = response.headers().content_length();
-            decltype(length) read_count = 0;
-            auto body_stream = response.body();
-
-            size_t last_read_count = 0;
-            do {
-                container_buffer<string> buffer;
-                const auto count = body_stream.read(buffer, 8192).get();
-                read_count += count;
-                last_read_count = count;
-                f << buffer.collection().substr(0, last_read_count);
-            } while (last_read_count > 0);
-
-
-            if (response.status_code() >= 200 && response.status_code() < 300
-                && (length > 0 && read_count == length
-                    || length == 0 && read_count > 0)) {
-                succeeded = true;
-            }
-        }
-    }).wait();
-
-    if (!succeeded && fs::exists(ansi_local_path)) {
-        fs::remove(ansi_local_path);
+    const auto timeout = Deadline::bound(config()->remote_json_timeout);
+    if (!timeout) {
+        return nullopt; // the API call it is made for has timed out
     }
-
-    return succeeded;
+    return get_remote_json_libcurl(url, use_fake_ua, cookies, *timeout);
 }
 
-static bool download_remote_file_libcurl(const string &url, const string &local_path, const bool use_fake_ua) {
+static bool download_remote_file_libcurl(const string &url, const string &local_path, const bool use_fake_ua,
+                                         const unsigned long timeout) {
     auto succeeded = false;
     const auto ansi_local_path = ansi(local_path);
 
@@ -153,6 +64,8 @@ static bool download_remote_file_libcurl(const string &url, const string &local_
         {"User-Agent", use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT},
         {"Referer", url}
     });
+    request.timeout = timeout;
+    request.follow_location = true;
 
     struct {
         size_t read_count;
@@ -163,7 +76,7 @@ static bool download_remote_file_libcurl(const string &url, const string &local_
         request.write_data = &write_data_wrapper;
         request.write_func = [](char *buf, size_t size, size_t count, void *data) -> size_t {
             auto wrapper = static_cast<decltype(write_data_wrapper) *>(data);
-            wrapper->file.write(buf, count);
+            wrapper->file.write(buf, size * count);
             wrapper->read_count += size * count;
             return size * count;
         };
@@ -186,52 +99,68 @@ static bool download_remote_file_libcurl(const string &url, const string &local_
 }
 
 bool download_remote_file(const string &url, const string &local_path, const bool use_fake_ua) {
-    if (is_in_wine()) {
-        return download_remote_file_libcurl(url, local_path, use_fake_ua);
+    const auto timeout = Deadline::bound(config()->download_timeout);
+    if (!timeout) {
+        return false; // the API call it is made for has timed out
     }
-    return download_remote_file_cpprestsdk(url, local_path, use_fake_ua);
+    return download_remote_file_libcurl(url, local_path, use_fake_ua, *timeout);
 }
 
-static HttpSimpleResponse post_json_cpprestsdk(const string &url, const json &payload) {
-    http_request request(http::methods::POST);
-    request.headers().add(L"User-Agent", CQAPP_USER_AGENT);
-    request.headers().add(L"Content-Type", L"application/json; charset=UTF-8");
-    const auto body = payload.dump();
-    request.set_body(payload.dump());
-    if (!config.secret.empty()) {
-        request.headers().add(L"X-Signature", s2ws("sha1=" + hmac_sha1_hex(config.secret, body)));
+static curl::Request make_post_request_libcurl(const string &url, const string &body,
+                                               const HttpPostOptions &options) {
+    auto request = curl::Request(url, "application/json; charset=UTF-8", body);
+    request.method = curl::Method::POST;
+    request.headers["User-Agent"] = CQAPP_USER_AGENT;
+    if (!options.secret.empty()) {
+        request.headers["X-Signature"] = "sha1=" + hmac_sha1_hex(options.secret, body);
     }
+    request.timeout = options.timeout;
+    return request;
+}
 
-    auto client = http_client(s2ws(url));
-    auto task = client.request(request);
-
-    HttpSimpleResponse result;
-    try {
-        auto resp = task.get();
-        result.status_code = resp.status_code();
-        result.body = resp.extract_utf8string(true).get();
-    } catch (...) {
-        // failed to request
-    }
-    return result;
+static HttpSimpleResponse post_json_libcurl(const string &url, const string &body, const HttpPostOptions &options) {
+    auto response = make_post_request_libcurl(url, body, options).send();
+    return {response.status_code, move(response.body)};
 }
 
-static HttpSimpleResponse post_json_libcurl(const string &url, const json &payload) {
-    const auto body = payload.dump();
-    auto request = curl::Request(url, "application/json; charset=UTF-8", body);
-    request.headers["User-Agent"] = CQAPP_USER_AGENT;
-    if (!config.secret.empty()) {
-        request.headers["X-Signature"] = "sha1=" + hmac_sha1_hex(config.secret, body);
+/**
+ * Fill in the default timeout and bound it by the deadline of the current thread,
+ * return nullopt if the deadline has passed.
+ */
+static optional<HttpPostOptions> effective_post_options(const HttpPostOptions &options) {
+    const auto timeout = Deadline::bound(options.timeout > 0 ? options.timeout : config()->post_timeout);
+    if (!timeout) {
+        return nullopt;
     }
+    auto effective_options = options;
+    effective_options.timeout = *timeout;
+    return effective_options;
+}
 
-    const auto response = request.post();
+HttpSimpleResponse post_json(const string &url, const string &body) {
+    HttpPostOptions options;
+    options.secret = config()->secret;
+    return post_json(url, body, options);
+}
 
-    return {response.status_code, response.body};
+HttpSimpleResponse post_json(const string &url, const string &body, const HttpPostOptions &post_options) {
+    const auto options = effective_post_options(post_options);
+    if (!options) {
+        return {};
+    }
+    return post_json_libcurl(url, body, *options);
 }
 
-HttpSimpleResponse post_json(const string &url, const json &payload) {
-    if (is_in_wine()) {
-        return post_json_libcurl(url, payload);
+void post_json_async(const string &url, const string &body, const HttpPostOptions &post_options,
+                     function<void(const HttpSimpleResponse &)> callback) {
+    const auto effective_options = effective_post_options(post_options);
+    if (!effective_options) {
+        callback(HttpSimpleResponse());
+        return;
     }
-    return post_json_cpprestsdk(url, payload);
+    const auto &options = *effective_options;
+
+    make_post_request_libcurl(url, body, options).send_async([callback](curl::Response &response) {
+        callback(HttpSimpleResponse{response.status_code, move(response.body)});
+    });
 }
@@ -2,9 +2,15 @@
 
 #include "common.h"
 
+/**
+ * Get a JSON (or JSONP) value, within "remote_json_timeout" and the deadline of the current thread.
+ */
 std::optional<json> get_remote_json(const std::string &url, const bool use_fake_ua = false,
                                     const std::string &cookies = "");
 
+/**
+ * Download a file, within "download_timeout" and the deadline of the current thread.
+ */
 bool download_remote_file(const std::string &url, const std::string &local_path, const bool use_fake_ua = false);
 
 struct HttpSimpleResponse {
@@ -16,4 +22,23 @@ struct HttpSimpleResponse {
     }
 };
 
-HttpSimpleResponse post_json(const std::string &url, const json &payload);
+struct HttpPostOptions {
+    std::string secret; // if not empty, the body is signed with it in the "X-Signature" header
+    unsigned long timeout = 0; // in milliseconds, 0 means "post_timeout" in the config
+};
+
+/**
+ * Post a serialized JSON value, e.g. JsonPayload::dump(), signed with "secret" in the config.
+ * The post is given at most the time left before the deadline of the current thread, see Deadline.
+ */
+HttpSimpleResponse post_json(const std::string &url, const std::string &body);
+
+HttpSimpleResponse post_json(const std::string &url, const std::string &body, const HttpPostOptions &options);
+
+/**
+ * Post a serialized JSON value without waiting for the response, which is passed to "callback" on the thread
+ * that drives all requests, so "callback" must not block, nor make a waiting request such as post_json().
+ * The body is copied before this returns.
+ */
+void post_json_async(const std::string &url, const std::string &body, const HttpPostOptions &options,
+                     std::function<void(const HttpSimpleResponse &)> callback);
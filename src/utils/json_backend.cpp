@@ -0,0 +1,182 @@
+#include "./json_backend.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#ifdef USE_RAPIDJSON
+#include <rapidjson/error/en.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/reader.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+#ifdef USE_RAPIDJSON
+
+const char *json_backend_name() { return "rapidjson"; }
+
+namespace {
+    // deeper values are rejected, nlohmann json copies and destroys values recursively
+    const size_t MAX_DEPTH = 512;
+
+    /**
+     * SAX handler that builds a nlohmann json value.
+     * Non-negative integers become unsigned numbers and negative ones signed, as nlohmann json's parser does.
+     */
+    class JsonBuilder {
+    public:
+        json result;
+
+        bool Null() { return add(nullptr); }
+        bool Bool(const bool b) { return add(b); }
+        bool Int(const int i) { return add(static_cast<json::number_integer_t>(i)); }
+        bool Uint(const unsigned u) { return add(static_cast<json::number_unsigned_t>(u)); }
+        bool Int64(const int64_t i) { return add(static_cast<json::number_integer_t>(i)); }
+        bool Uint64(const uint64_t u) { return add(static_cast<json::number_unsigned_t>(u)); }
+        bool Double(const double d) { return add(d); }
+        bool RawNumber(const char *, rapidjson::SizeType, bool) { return false; } // not enabled
+
+        bool String(const char *str, const rapidjson::SizeType length, bool) {
+            return add(json::string_t(str, length));
+        }
+
+        bool StartObject() {
+            if (containers_.size() >= MAX_DEPTH) {
+                return false;
+            }
+            containers_.push_back(&slot(json::object()));
+            return true;
+        }
+
+        bool Key(const char *str, const rapidjson::SizeType length, bool) {
+            key_.assign(str, length);
+            return true;
+        }
+
+        bool EndObject(rapidjson::SizeType) {
+            containers_.pop_back();
+            return true;
+        }
+
+        bool StartArray() {
+            if (containers_.size() >= MAX_DEPTH) {
+                return false;
+            }
+            containers_.push_back(&slot(json::array()));
+            return true;
+        }
+
+        bool EndArray(rapidjson::SizeType) {
+            containers_.pop_back();
+            return true;
+        }
+
+    private:
+        // the containers being filled, from the root to the innermost one,
+        // pointers stay valid because a container gets no new element until the inner one is done
+        vector<json *> containers_;
+        string key_;
+
+        json &slot(json &&value) {
+            if (containers_.empty()) {
+                result = move(value);
+                return result;
+            }
+            auto &container = *containers_.back();
+            if (container.is_array()) {
+                container.push_back(move(value));
+                return container.back();
+            }
+            auto &member = container[key_]; // the last of duplicate keys wins, as in nlohmann json
+            member = move(value);
+            return member;
+        }
+
+        bool add(json &&value) {
+            slot(move(value));
+            return true;
+        }
+    };
+
+    using Writer = rapidjson::Writer<rapidjson::StringBuffer>;
+
+    void write(Writer &writer, const json &value) {
+        switch (value.type()) {
+        case json::value_t::boolean:
+            writer.Bool(value.get<bool>());
+            break;
+        case json::value_t::number_integer:
+            writer.Int64(value.get<json::number_integer_t>());
+            break;
+        case json::value_t::number_unsigned:
+            writer.Uint64(value.get<json::number_unsigned_t>());
+            break;
+        case json::value_t::number_float:
+            if (const auto d = value.get<json::number_float_t>(); isfinite(d)) {
+                writer.Double(d);
+            } else {
+                writer.Null(); // nlohmann json also writes null for NaN and infinity
+            }
+            break;
+        case json::value_t::string: {
+            const auto &str = value.get_ref<const json::string_t &>();
+            writer.String(str.data(), static_cast<rapidjson::SizeType>(str.size()));
+            break;
+        }
+        case json::value_t::array:
+            writer.StartArray();
+            for (const auto &element : value) {
+                write(writer, element);
+            }
+            writer.EndArray();
+            break;
+        case json::value_t::object:
+            writer.StartObject();
+            for (auto it = value.cbegin(); it != value.cend(); ++it) {
+                const auto &key = it.key();
+                writer.Key(key.data(), static_cast<rapidjson::SizeType>(key.size()));
+                write(writer, it.value());
+            }
+            writer.EndObject();
+            break;
+        default: // null and discarded
+            writer.Null();
+            break;
+        }
+    }
+} // namespace
+
+json parse_json(const char *begin, const char *end) {
+    rapidjson::MemoryStream stream(begin, end - begin);
+    rapidjson::Reader reader;
+    JsonBuilder builder;
+    // the iterative parser keeps its state on the heap, so a deeply nested body can't overflow the stack
+    if (const auto res = reader.Parse<rapidjson::kParseFullPrecisionFlag | rapidjson::kParseIterativeFlag>(
+            stream, builder);
+        res.IsError()) {
+        throw invalid_argument(string(rapidjson::GetParseError_En(res.Code())) + " at offset "
+                               + to_string(res.Offset()));
+    }
+    return move(builder.result);
+}
+
+string dump_json(const json &value) {
+    rapidjson::StringBuffer buffer;
+    Writer writer(buffer);
+    write(writer, value);
+    return string(buffer.GetString(), buffer.GetSize());
+}
+
+#else
+
+const char *json_backend_name() { return "nlohmann"; }
+
+json parse_json(const char *begin, const char *end) { return json::parse(begin, end); }
+
+string dump_json(const json &value) { return value.dump(); }
+
+#endif
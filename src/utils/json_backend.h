@@ -0,0 +1,48 @@
+// 
+// json_backend.h : Parse and serialize JSON text on the hot paths (API requests and responses, events).
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+#pragma once
+
+#include <string>
+#include <nlohmann/json.hpp>
+
+// The values are still nlohmann json values, only reading and writing the text is done by the backend.
+// With USE_RAPIDJSON defined, RapidJSON's SAX reader and writer are used, otherwise nlohmann json's own.
+// The plugin doesn't define it yet, see bench/README.md for what has to be measured first.
+// Config files and event filters are not on the hot paths and always use nlohmann json directly.
+
+/**
+ * Name of the backend in use, e.g. "rapidjson".
+ */
+const char *json_backend_name();
+
+/**
+ * Parse JSON text.
+ * \throw std::invalid_argument if the text is not valid JSON
+ */
+nlohmann::json parse_json(const char *begin, const char *end);
+
+inline nlohmann::json parse_json(const std::string &text) {
+    return parse_json(text.data(), text.data() + text.size());
+}
+
+/**
+ * Serialize a JSON value compactly, the same as "value.dump()".
+ */
+std::string dump_json(const nlohmann::json &value);
@@ -0,0 +1,73 @@
+// 
+// json_payload_class.h : Define JsonPayload class,
+// which serializes a json value lazily and at most once for each format.
+// 
+// Copyright (C) 2017  Richard Chien <richardchienthebest@gmail.com>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+#pragma once
+
+#include "common.h"
+
+#include <mutex>
+
+#include "./json_backend.h"
+
+/**
+ * An immutable json value shared by everyone who sends it (e.g. an event pushed to several services),
+ * so that each serialized form is built only once, by whoever needs it first.
+ */
+class JsonPayload {
+public:
+    explicit JsonPayload(json value) : value_(std::move(value)) {}
+
+    JsonPayload(const JsonPayload &) = delete;
+    JsonPayload &operator=(const JsonPayload &) = delete;
+
+    const json &value() const { return value_; }
+
+    const std::string &dump() const {
+        std::call_once(dump_.flag, [this] { dump_.data = dump_json(value_); });
+        return dump_.data;
+    }
+
+    const std::string &msgpack() const {
+        std::call_once(msgpack_.flag, [this] {
+            const auto bytes = json::to_msgpack(value_);
+            msgpack_.data.assign(bytes.begin(), bytes.end());
+        });
+        return msgpack_.data;
+    }
+
+    const std::string &cbor() const {
+        std::call_once(cbor_.flag, [this] {
+            const auto bytes = json::to_cbor(value_);
+            cbor_.data.assign(bytes.begin(), bytes.end());
+        });
+        return cbor_.data;
+    }
+
+private:
+    struct Serialized {
+        std::once_flag flag;
+        std::string data;
+    };
+
+    const json value_;
+    mutable Serialized dump_;
+    mutable Serialized msgpack_;
+    mutable Serialized cbor_;
+};
@@ -25,53 +25,53 @@
 
 using namespace std;
 
-optional<json> Params::get(const string &key) const {
-    if (const auto it = params_.find(key); it != params_.end()) {
-        return *it;
+const json *Params::get(const string &key) const {
+    if (params_) {
+        if (const auto it = params_->find(key); it != params_->end()) {
+            return &*it;
+        }
     }
-    return nullopt;
+    return nullptr;
 }
 
 string Params::get_string(const string &key, const string &default_val) const {
     auto result = default_val;
-    if (auto v_opt = get(key); v_opt && v_opt->is_string()) {
-        return v_opt->get<string>();
+    if (const auto v = get(key); v && v->is_string()) {
+        return v->get<string>();
     }
     return result;
 }
 
 string Params::get_message(const string &key, const string &auto_escape_key) const {
-    if (auto msg_opt = get(key); msg_opt && !msg_opt->is_null()) {
-        if (msg_opt->is_string()) {
-            if (get_bool(auto_escape_key, false)) {
-                msg_opt = Message::escape(msg_opt->get<string>());
-            }
+    if (const auto msg = get(key); msg && !msg->is_null()) {
+        if (msg->is_string() && get_bool(auto_escape_key, false)) {
+            return Message(Message::escape(msg->get<string>())).process_outward();
         }
-        return Message(msg_opt.value()).process_outward();
+        return Message(*msg).process_outward();
     }
     return "";
 }
 
 int64_t Params::get_integer(const string &key, const int64_t default_val) const {
     auto result = default_val;
-    if (auto v_opt = get(key); v_opt && v_opt->is_string()) {
+    if (const auto v = get(key); v && v->is_string()) {
         try {
-            result = stoll(v_opt->get<string>());
+            result = stoll(v->get<string>());
         } catch (invalid_argument &) {
             // invalid integer string
         }
-    } else if (v_opt->is_number_integer()) {
-        result = v_opt->get<int64_t>();
+    } else if (v && v->is_number_integer()) {
+        result = v->get<int64_t>();
     }
     return result;
 }
 
 bool Params::get_bool(const string &key, const bool default_val) const {
     auto result = default_val;
-    if (auto v_opt = get(key); v_opt && v_opt->is_string()) {
-        result = to_bool(v_opt->get<string>(), default_val);
-    } else if (v_opt->is_boolean()) {
-        result = v_opt->get<bool>();
+    if (const auto v = get(key); v && v->is_string()) {
+        result = to_bool(v->get<string>(), default_val);
+    } else if (v && v->is_boolean()) {
+        result = v->get<bool>();
     }
     return result;
 }
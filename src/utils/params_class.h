@@ -22,21 +22,27 @@
 
 #include "common.h"
 
+#include <memory>
+
+/**
+ * The parameters are immutable once constructed, so copies of a Params
+ * (e.g. the one captured by an async task) share the same json object.
+ */
 class Params {
 public:
-    Params() : params_(nullptr) {}
-    explicit Params(const json &j) : params_(j) {}
-    explicit Params(const json &&j) : params_(j) {}
+    Params() = default;
+    explicit Params(const json &j) : params_(std::make_shared<const json>(j)) {}
+    explicit Params(json &&j) : params_(std::make_shared<const json>(std::move(j))) {}
 
     /**
-     * Return std::nullopt if the key does not exist.
+     * Return nullptr if the key does not exist.
+     * The value stays valid as long as this Params, or any copy of it, is alive.
      */
-    std::optional<json> get(const std::string &key) const;
+    const json *get(const std::string &key) const;
 
     template <typename Type>
     std::optional<Type> get(const std::string &key) const {
-        auto v = get(key);
-        if (v) {
+        if (const auto v = get(key)) {
             try {
                 return v->get<Type>();
             } catch (std::domain_error &) {
@@ -53,5 +59,5 @@ public:
     bool get_bool(const std::string &key, const bool default_val = false) const;
 
 private:
-    json params_;
+    std::shared_ptr<const json> params_;
 };
@@ -2,7 +2,9 @@
 #define CLIENT_WS_HPP
 
 #include "crypto.hpp"
+#include "permessage_deflate.hpp"
 #include "utility.hpp"
+#include "websocket_mask.hpp"
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/asio.hpp>
@@ -65,6 +67,8 @@ namespace SimpleWeb {
     public:
       std::string http_version, status_code;
       CaseInsensitiveMultimap header;
+      /// Sec-WebSocket-Protocol selected by the server, empty if none
+      std::string protocol;
       std::string remote_endpoint_address;
       unsigned short remote_endpoint_port;
 
@@ -163,6 +167,9 @@ namespace SimpleWeb {
 
       std::atomic<bool> closed;
 
+      std::unique_ptr<PerMessageDeflate> permessage_deflate;
+      std::size_t compression_threshold = 0;
+
       void read_remote_endpoint_data() noexcept {
         try {
           remote_endpoint_address = socket->lowest_layer().remote_endpoint().address().to_string();
@@ -181,45 +188,72 @@ namespace SimpleWeb {
         cancel_timeout();
         set_timeout();
 
-        // Create mask
-        std::vector<unsigned char> mask;
-        mask.resize(4);
-        std::uniform_int_distribution<unsigned short> dist(0, 255);
-        std::random_device rd;
-        for(std::size_t c = 0; c < 4; c++)
-          mask[c] = static_cast<unsigned char>(dist(rd));
+        std::string data(asio::buffers_begin(message_stream->streambuf.data()), asio::buffers_end(message_stream->streambuf.data()));
+        message_stream->streambuf.consume(data.size());
 
-        auto send_stream = std::make_shared<SendStream>();
+        auto self = this->shared_from_this();
+        strand.post([self, data = std::move(data), callback, fin_rsv_opcode]() {
+          auto payload = &data;
+          auto frame_fin_rsv_opcode = fin_rsv_opcode;
+
+          // Compress in strand, since the compression context depends on the order in which messages are sent.
+          // Only unfragmented text and binary messages are compressed.
+          std::string compressed;
+          auto opcode = fin_rsv_opcode & 0x0f;
+          if(self->permessage_deflate && (fin_rsv_opcode & 0x80) && (opcode == 1 || opcode == 2) &&
+             data.size() >= self->compression_threshold) {
+            try {
+              compressed = self->permessage_deflate->compress(data.data(), data.size());
+              payload = &compressed;
+              frame_fin_rsv_opcode |= 0x40; // RSV1 marks a compressed message
+            }
+            catch(...) {
+              if(callback)
+                callback(make_error_code::make_error_code(errc::operation_not_supported));
+              return;
+            }
+          }
 
-        std::size_t length = message_stream->size();
+          // Create mask
+          unsigned char mask[4];
+          std::random_device rd;
+          auto random = static_cast<std::uint32_t>(rd());
+          std::memcpy(mask, &random, 4);
+
+          std::size_t length = payload->size();
+
+          // Frame header: at most 2 + 8 bytes, followed by the 4 byte mask
+          unsigned char header[14];
+          std::size_t header_length = 0;
+          header[header_length++] = frame_fin_rsv_opcode;
+          // Masked (first length byte>=128)
+          if(length >= 126) {
+            std::size_t num_bytes;
+            if(length > 0xffff) {
+              num_bytes = 8;
+              header[header_length++] = 127 + 128;
+            }
+            else {
+              num_bytes = 2;
+              header[header_length++] = 126 + 128;
+            }
 
-        send_stream->put(static_cast<char>(fin_rsv_opcode));
-        // Masked (first length byte>=128)
-        if(length >= 126) {
-          std::size_t num_bytes;
-          if(length > 0xffff) {
-            num_bytes = 8;
-            send_stream->put(static_cast<char>(127 + 128));
-          }
-          else {
-            num_bytes = 2;
-            send_stream->put(static_cast<char>(126 + 128));
+            for(std::size_t c = num_bytes - 1; c != static_cast<std::size_t>(-1); c--)
+              header[header_length++] = (static_cast<unsigned long long>(length) >> (8 * c)) % 256;
           }
+          else
+            header[header_length++] = static_cast<unsigned char>(length + 128);
 
-          for(std::size_t c = num_bytes - 1; c != static_cast<std::size_t>(-1); c--)
-            send_stream->put((static_cast<unsigned long long>(length) >> (8 * c)) % 256);
-        }
-        else
-          send_stream->put(static_cast<char>(length + 128));
-
-        for(std::size_t c = 0; c < 4; c++)
-          send_stream->put(static_cast<char>(mask[c]));
+          std::memcpy(header + header_length, mask, 4);
+          header_length += 4;
 
-        for(std::size_t c = 0; c < length; c++)
-          send_stream->put(message_stream->get() ^ mask[c % 4]);
+          // Write the header and mask the payload straight into the send buffer
+          auto send_stream = std::make_shared<SendStream>();
+          auto frame = asio::buffer_cast<unsigned char *>(send_stream->streambuf.prepare(header_length + length));
+          std::memcpy(frame, header, header_length);
+          websocket_mask(frame + header_length, reinterpret_cast<const unsigned char *>(payload->data()), length, mask);
+          send_stream->streambuf.commit(header_length + length);
 
-        auto self = this->shared_from_this();
-        strand.post([self, send_stream, callback]() {
           self->send_queue.emplace_back(send_stream, callback);
           if(self->send_queue.size() == 1)
             self->send_from_queue();
@@ -286,6 +320,16 @@ namespace SimpleWeb {
       /// Additional header fields to send when performing WebSocket handshake.
       /// Use this variable to for instance set Sec-WebSocket-Protocol.
       CaseInsensitiveMultimap header;
+      /// Offer the permessage-deflate extension (RFC 7692) to the server. Defaults to false.
+      bool permessage_deflate = false;
+      /// zlib compression level, 0-9 or -1 for zlib's default.
+      int compression_level = -1;
+      /// Reset the compression contexts after each message, trading compression ratio for memory. Defaults to false.
+      bool no_context_takeover = false;
+      /// Messages smaller than this size in bytes are sent uncompressed. Defaults to 0.
+      std::size_t compression_threshold = 0;
+      /// Maximum size in bytes of a decompressed message, larger ones close the connection with 1009. Defaults to 0 (unlimited).
+      std::size_t max_inflated_message_size = 0;
     };
     /// Set before calling start().
     Config config;
@@ -393,6 +437,12 @@ namespace SimpleWeb {
       auto nonce_base64 = std::make_shared<std::string>(Crypto::Base64::encode(nonce));
       request << "Sec-WebSocket-Key: " << *nonce_base64 << "\r\n";
       request << "Sec-WebSocket-Version: 13\r\n";
+      if(config.permessage_deflate) {
+        request << "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits";
+        if(config.no_context_takeover)
+          request << "; client_no_context_takeover; server_no_context_takeover";
+        request << "\r\n";
+      }
       for(auto &header_field : config.header)
         request << header_field.first << ": " << header_field.second << "\r\n";
       request << "\r\n";
@@ -422,6 +472,10 @@ namespace SimpleWeb {
               static auto ws_magic_string = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
               if(header_it != connection->header.end() &&
                  Crypto::Base64::decode(header_it->second) == Crypto::sha1(*nonce_base64 + ws_magic_string)) {
+                if(!this->accept_protocol(connection) || !this->accept_extensions(connection)) {
+                  this->connection_error(connection, make_error_code::make_error_code(errc::protocol_error));
+                  return;
+                }
                 this->connection_open(connection);
                 read_message(connection);
               }
@@ -437,6 +491,63 @@ namespace SimpleWeb {
       });
     }
 
+    /// Returns false if the server selected a subprotocol that we didn't offer.
+    bool accept_protocol(const std::shared_ptr<Connection> &connection) {
+      connection->protocol.clear();
+      auto header_it = connection->header.find("Sec-WebSocket-Protocol");
+      if(header_it == connection->header.end())
+        return true;
+
+      auto range = config.header.equal_range("Sec-WebSocket-Protocol");
+      for(auto it = range.first; it != range.second; ++it) {
+        std::size_t begin = 0;
+        while(begin <= it->second.size()) {
+          auto end = std::min(it->second.find(',', begin), it->second.size());
+          auto offer = it->second.substr(begin, end - begin);
+          begin = end + 1;
+
+          offer.erase(0, offer.find_first_not_of(" \t"));
+          offer.erase(offer.find_last_not_of(" \t") + 1);
+          if(offer == header_it->second) {
+            connection->protocol = offer;
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    /// Returns false if the server responded with extension parameters that we didn't offer or can't support.
+    bool accept_extensions(const std::shared_ptr<Connection> &connection) {
+      connection->permessage_deflate = nullptr;
+      auto header_it = connection->header.find("Sec-WebSocket-Extensions");
+      if(header_it == connection->header.end())
+        return true;
+
+      for(auto &response : ExtensionOffer::parse(header_it->second)) {
+        if(response.name != "permessage-deflate" || !config.permessage_deflate || connection->permessage_deflate)
+          return false;
+
+        // zlib can't compress with a raw deflate window of 8 bits, and we always inflate with the maximum window
+        auto client_window_bits = response.window_bits("client_max_window_bits");
+        if(client_window_bits < 9 || response.window_bits("server_max_window_bits") < 0)
+          return false;
+
+        try {
+          connection->permessage_deflate = std::unique_ptr<PerMessageDeflate>(new PerMessageDeflate(
+              config.compression_level, client_window_bits,
+              config.no_context_takeover || response.params.count("client_no_context_takeover") > 0,
+              config.no_context_takeover || response.params.count("server_no_context_takeover") > 0,
+              config.max_inflated_message_size));
+        }
+        catch(...) {
+          return false;
+        }
+        connection->compression_threshold = config.compression_threshold;
+      }
+      return true;
+    }
+
     void read_message(const std::shared_ptr<Connection> &connection) {
       asio::async_read(*connection->socket, connection->message->streambuf, asio::transfer_exactly(2), [this, connection](const error_code &ec, std::size_t bytes_transferred) {
         auto lock = connection->handler_runner->continue_lock();
@@ -545,10 +656,42 @@ namespace SimpleWeb {
             auto empty_send_stream = std::make_shared<SendStream>();
             connection->send(empty_send_stream, nullptr, connection->message->fin_rsv_opcode + 1);
           }
-          else if(this->on_message) {
-            connection->cancel_timeout();
-            connection->set_timeout();
-            this->on_message(connection, connection->message);
+          else {
+            // If compressed (RSV1 set)
+            if((connection->message->fin_rsv_opcode & 0x40) != 0) {
+              if(!connection->permessage_deflate || (connection->message->fin_rsv_opcode & 0x08) != 0) {
+                const std::string reason("unexpected reserved bit");
+                connection->send_close(1002, reason);
+                this->connection_close(connection, 1002, reason);
+                return;
+              }
+              try {
+                auto compressed = connection->message->string();
+                auto decompressed = connection->permessage_deflate->decompress(compressed.data(), compressed.size());
+                std::ostream message_data_out_stream(&connection->message->streambuf);
+                message_data_out_stream.write(decompressed.data(), static_cast<std::streamsize>(decompressed.size()));
+                connection->message->clear(); // string() may have set eof
+                connection->message->length = decompressed.size();
+              }
+              catch(const MessageTooBig &) {
+                const std::string reason("message too big");
+                connection->send_close(1009, reason);
+                this->connection_close(connection, 1009, reason);
+                return;
+              }
+              catch(...) {
+                const std::string reason("invalid compressed data");
+                connection->send_close(1007, reason);
+                this->connection_close(connection, 1007, reason);
+                return;
+              }
+            }
+
+            if(this->on_message) {
+              connection->cancel_timeout();
+              connection->set_timeout();
+              this->on_message(connection, connection->message);
+            }
           }
 
           // Next message
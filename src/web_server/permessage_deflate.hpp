@@ -0,0 +1,188 @@
+#ifndef SIMPLE_WEB_PERMESSAGE_DEFLATE_HPP
+#define SIMPLE_WEB_PERMESSAGE_DEFLATE_HPP
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace SimpleWeb {
+  /// One offer (or response) in a Sec-WebSocket-Extensions header field, e.g. "permessage-deflate; client_max_window_bits".
+  class ExtensionOffer {
+  public:
+    std::string name;
+    std::map<std::string, std::string> params;
+
+    /// Parses a Sec-WebSocket-Extensions header field value into its comma separated offers.
+    static std::vector<ExtensionOffer> parse(const std::string &header_value) {
+      std::vector<ExtensionOffer> offers;
+
+      auto trim = [](const std::string &str) {
+        auto begin = str.find_first_not_of(" \t");
+        if(begin == std::string::npos)
+          return std::string();
+        auto end = str.find_last_not_of(" \t");
+        return str.substr(begin, end - begin + 1);
+      };
+
+      std::size_t offer_begin = 0;
+      while(offer_begin <= header_value.size()) {
+        auto offer_end = std::min(header_value.find(',', offer_begin), header_value.size());
+        auto offer_str = header_value.substr(offer_begin, offer_end - offer_begin);
+        offer_begin = offer_end + 1;
+
+        ExtensionOffer offer;
+        std::size_t param_begin = 0;
+        bool first = true;
+        while(param_begin <= offer_str.size()) {
+          auto param_end = std::min(offer_str.find(';', param_begin), offer_str.size());
+          auto param_str = trim(offer_str.substr(param_begin, param_end - param_begin));
+          param_begin = param_end + 1;
+
+          if(first) {
+            offer.name = param_str;
+            first = false;
+            continue;
+          }
+          if(param_str.empty())
+            continue;
+
+          auto eq_pos = param_str.find('=');
+          if(eq_pos == std::string::npos)
+            offer.params.emplace(param_str, "");
+          else {
+            auto value = trim(param_str.substr(eq_pos + 1));
+            if(value.size() >= 2 && value.front() == '"' && value.back() == '"')
+              value = value.substr(1, value.size() - 2);
+            offer.params.emplace(trim(param_str.substr(0, eq_pos)), value);
+          }
+        }
+
+        if(!offer.name.empty())
+          offers.emplace_back(std::move(offer));
+      }
+
+      return offers;
+    }
+
+    /// Returns the window bits given in the parameter, or -1 if it is invalid.
+    int window_bits(const std::string &param, int default_value = 15) const {
+      auto it = params.find(param);
+      if(it == params.end() || it->second.empty())
+        return default_value;
+      try {
+        auto bits = std::stoi(it->second);
+        return bits >= 8 && bits <= 15 ? bits : -1;
+      }
+      catch(...) {
+        return -1;
+      }
+    }
+  };
+
+  /// Thrown by PerMessageDeflate::decompress() when a message inflates beyond the size limit.
+  class MessageTooBig : public std::length_error {
+  public:
+    MessageTooBig() : std::length_error("decompressed message too big") {}
+  };
+
+  /// Compression state of one connection using the permessage-deflate extension, see https://tools.ietf.org/html/rfc7692.
+  /// Not thread safe: compress() must be called in the order messages are sent, and decompress() in the order they are received.
+  class PerMessageDeflate {
+  public:
+    /// deflate_window_bits must be between 9 and 15, since zlib doesn't support a raw deflate window of 8 bits.
+    /// max_inflated_size limits the size of a decompressed message, 0 means unlimited.
+    PerMessageDeflate(int level, int deflate_window_bits, bool deflate_no_context_takeover, bool inflate_no_context_takeover,
+                      std::size_t max_inflated_size = 0)
+        : deflate_no_context_takeover(deflate_no_context_takeover), inflate_no_context_takeover(inflate_no_context_takeover),
+          max_inflated_size(max_inflated_size) {
+      if(deflateInit2(&deflater, level, Z_DEFLATED, -deflate_window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("failed to initialize deflater");
+      if(inflateInit2(&inflater, -15) != Z_OK) {
+        deflateEnd(&deflater);
+        throw std::runtime_error("failed to initialize inflater");
+      }
+    }
+
+    PerMessageDeflate(const PerMessageDeflate &) = delete;
+    PerMessageDeflate &operator=(const PerMessageDeflate &) = delete;
+
+    ~PerMessageDeflate() noexcept {
+      deflateEnd(&deflater);
+      inflateEnd(&inflater);
+    }
+
+    /// Whether each compressed message can be decompressed on its own, i.e. whether it may be discarded
+    /// without breaking the messages compressed after it.
+    bool compresses_independently() const noexcept {
+      return deflate_no_context_takeover;
+    }
+
+    std::string compress(const char *data, std::size_t size) {
+      std::string out;
+      out.reserve(size / 2 + 16);
+
+      deflater.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+      deflater.avail_in = static_cast<uInt>(size);
+      char buffer[16384];
+      do {
+        deflater.next_out = reinterpret_cast<Bytef *>(buffer);
+        deflater.avail_out = sizeof(buffer);
+        auto ret = deflate(&deflater, Z_SYNC_FLUSH);
+        if(ret != Z_OK && ret != Z_BUF_ERROR)
+          throw std::runtime_error("failed to compress message");
+        out.append(buffer, sizeof(buffer) - deflater.avail_out);
+      } while(deflater.avail_out == 0);
+
+      // Remove the empty stored block that Z_SYNC_FLUSH appends, as required by RFC 7692 section 7.2.1
+      if(out.size() >= 4 && out.compare(out.size() - 4, 4, "\x00\x00\xff\xff", 4) == 0)
+        out.resize(out.size() - 4);
+
+      if(deflate_no_context_takeover)
+        deflateReset(&deflater);
+      return out;
+    }
+
+    /// Throws MessageTooBig if the message inflates beyond max_inflated_size, after which the inflater must not be used again.
+    std::string decompress(const char *data, std::size_t size) {
+      std::string in;
+      in.reserve(size + 4);
+      in.append(data, size);
+      in.append("\x00\x00\xff\xff", 4);
+
+      std::string out;
+      out.reserve(max_inflated_size > 0 ? std::min(size * 2, max_inflated_size) : size * 2);
+
+      inflater.next_in = reinterpret_cast<Bytef *>(&in[0]);
+      inflater.avail_in = static_cast<uInt>(in.size());
+      char buffer[16384];
+      do {
+        inflater.next_out = reinterpret_cast<Bytef *>(buffer);
+        inflater.avail_out = sizeof(buffer);
+        auto ret = inflate(&inflater, Z_SYNC_FLUSH);
+        if(ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END)
+          throw std::runtime_error("failed to decompress message");
+        out.append(buffer, sizeof(buffer) - inflater.avail_out);
+        // Stop as soon as the limit is crossed, a few KB of input may inflate to gigabytes
+        if(max_inflated_size > 0 && out.size() > max_inflated_size)
+          throw MessageTooBig();
+      } while(inflater.avail_out == 0);
+
+      if(inflate_no_context_takeover)
+        inflateReset(&inflater);
+      return out;
+    }
+
+  private:
+    z_stream deflater{};
+    z_stream inflater{};
+    bool deflate_no_context_takeover;
+    bool inflate_no_context_takeover;
+    std::size_t max_inflated_size;
+  };
+} // namespace SimpleWeb
+
+#endif /* SIMPLE_WEB_PERMESSAGE_DEFLATE_HPP */
@@ -2,12 +2,15 @@
 #define SERVER_HTTP_HPP
 
 #include "utility.hpp"
+#include <array>
 #include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <sstream>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
 #ifdef USE_STANDALONE_ASIO
@@ -56,6 +59,9 @@ namespace SimpleWeb {
 
       asio::streambuf streambuf;
 
+      asio::const_buffer content_buffer;
+      std::shared_ptr<const void> content_owner;
+
       std::shared_ptr<Session> session;
       long timeout_content;
 
@@ -88,16 +94,38 @@ namespace SimpleWeb {
       void send(const std::function<void(const error_code &)> &callback = nullptr) {
         session->connection->set_timeout(timeout_content);
         auto self = this->shared_from_this(); // Keep Response instance alive through the following async_write
-        asio::async_write(*session->connection->socket, streambuf, [self, callback](const error_code &ec, size_t /*bytes_transferred*/) {
+        auto handler = [self, callback](const error_code &ec) {
           self->session->connection->cancel_timeout();
           auto cancel_pair = self->session->connection->cancel_handlers_bool_and_lock();
           if(cancel_pair.first)
             return;
           if(callback)
             callback(ec);
+        };
+
+        if(content_owner) {
+          // Gather the stream buffer and the content given to write_content() into one write, without copying the content
+          auto content_owner = std::move(this->content_owner);
+          std::array<asio::const_buffer, 2> buffers{{streambuf.data(), content_buffer}};
+          asio::async_write(*session->connection->socket, buffers, [self, content_owner, handler](const error_code &ec, size_t /*bytes_transferred*/) {
+            self->streambuf.consume(self->streambuf.size());
+            handler(ec);
+          });
+          return;
+        }
+
+        asio::async_write(*session->connection->socket, streambuf, [handler](const error_code &ec, size_t /*bytes_transferred*/) {
+          handler(ec);
         });
       }
 
+      /// Send content after what has been written to the stream buffer, without copying it into the stream buffer.
+      /// The owner, for instance a cached string or a memory mapped file, is kept alive until the content has been sent.
+      void write_content(const char *data, std::size_t size, std::shared_ptr<const void> owner) {
+        content_buffer = asio::const_buffer(data, size);
+        content_owner = std::move(owner);
+      }
+
       /// Write directly to stream buffer using std::ostream::write
       void write(const char_type *ptr, std::streamsize n) {
         std::ostream::write(ptr, n);
@@ -106,7 +134,14 @@ namespace SimpleWeb {
       /// Convenience function for writing status line, potential header fields, and empty content
       void write(StatusCode status_code = StatusCode::success_ok, const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
         *this << "HTTP/1.1 " << SimpleWeb::status_code(status_code) << "\r\n";
-        write_header(header, 0);
+        // 204 and 304 responses never have content, so Content-Length: 0 would be wrong (RFC 7230 section 3.3.2)
+        if(status_code == StatusCode::success_no_content || status_code == StatusCode::redirection_not_modified) {
+          for(auto &field : header)
+            *this << field.first << ": " << field.second << "\r\n";
+          *this << "\r\n";
+        }
+        else
+          write_header(header, 0);
       }
 
       /// Convenience function for writing status line, header fields, and content
@@ -163,6 +198,12 @@ namespace SimpleWeb {
         ss << rdbuf();
         return ss.str();
       }
+      /// Returns the unread content without copying or consuming it.
+      /// The view is invalidated when the content is read from, or the request is destroyed.
+      std::string_view view() const {
+        auto data = streambuf.data();
+        return std::string_view(asio::buffer_cast<const char *>(data), asio::buffer_size(data));
+      }
 
     private:
       asio::streambuf &streambuf;
@@ -269,6 +310,14 @@ namespace SimpleWeb {
 
       std::unique_ptr<asio::deadline_timer> timer;
 
+      /// Bytes of the next pipelined request, read along with the previous one
+      std::string pipelined_data;
+
+      /// Remote endpoint, looked up once for all requests on this connection
+      std::string remote_endpoint_address;
+      unsigned short remote_endpoint_port = 0;
+      bool remote_endpoint_read = false;
+
       void close() {
         error_code ec;
         std::unique_lock<std::mutex> lock(socket_close_mutex); // The following operations seems to be needed to run sequentially
@@ -307,13 +356,17 @@ namespace SimpleWeb {
     class Session {
     public:
       Session(std::shared_ptr<Connection> connection) : connection(std::move(connection)) {
-        try {
-          auto remote_endpoint = this->connection->socket->lowest_layer().remote_endpoint();
-          request = std::shared_ptr<Request>(new Request(remote_endpoint.address().to_string(), remote_endpoint.port()));
-        }
-        catch(...) {
-          request = std::shared_ptr<Request>(new Request());
+        if(!this->connection->remote_endpoint_read) {
+          try {
+            auto remote_endpoint = this->connection->socket->lowest_layer().remote_endpoint();
+            this->connection->remote_endpoint_address = remote_endpoint.address().to_string();
+            this->connection->remote_endpoint_port = remote_endpoint.port();
+            this->connection->remote_endpoint_read = true;
+          }
+          catch(...) {
+          }
         }
+        request = std::shared_ptr<Request>(new Request(this->connection->remote_endpoint_address, this->connection->remote_endpoint_port));
       }
 
       std::shared_ptr<Connection> connection;
@@ -361,6 +414,10 @@ namespace SimpleWeb {
     /// Warning: do not add or remove resources after start() is called
     std::map<regex_orderable, std::map<std::string, std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>, std::shared_ptr<typename ServerBase<socket_type>::Request>)>>> resource;
 
+    /// Resources matched by exact path, which are looked up before the regular expressions in resource.
+    /// Warning: do not add or remove resources after start() is called
+    std::unordered_map<std::string, std::map<std::string, std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>, std::shared_ptr<typename ServerBase<socket_type>::Request>)>>> exact_resource;
+
     std::map<std::string, std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Response>, std::shared_ptr<typename ServerBase<socket_type>::Request>)>> default_resource;
 
     std::function<void(std::shared_ptr<typename ServerBase<socket_type>::Request>, const error_code &)> on_error;
@@ -481,6 +538,13 @@ namespace SimpleWeb {
     }
 
     void read_request_and_content(const std::shared_ptr<Session> &session) {
+      if(!session->connection->pipelined_data.empty()) {
+        // async_read_until() below finds the next request in the stream buffer without reading from the socket
+        std::ostream stream(&session->request->streambuf);
+        stream.write(session->connection->pipelined_data.data(), static_cast<std::streamsize>(session->connection->pipelined_data.size()));
+        session->connection->pipelined_data.clear();
+      }
+
       session->connection->set_timeout(config.timeout_request);
       asio::async_read_until(*session->connection->socket, session->request->streambuf, "\r\n\r\n", [this, session](const error_code &ec, size_t bytes_transferred) {
         session->connection->cancel_timeout();
@@ -498,9 +562,9 @@ namespace SimpleWeb {
             return;
 
           // If content, read that as well
+          unsigned long long content_length = 0;
           auto it = session->request->header.find("Content-Length");
           if(it != session->request->header.end()) {
-            unsigned long long content_length = 0;
             try {
               content_length = stoull(it->second);
             }
@@ -509,24 +573,33 @@ namespace SimpleWeb {
                 this->on_error(session->request, make_error_code::make_error_code(errc::protocol_error));
               return;
             }
-            if(content_length > num_additional_bytes) {
-              session->connection->set_timeout(config.timeout_content);
-              asio::async_read(*session->connection->socket, session->request->streambuf, asio::transfer_exactly(content_length - num_additional_bytes), [this, session](const error_code &ec, size_t /*bytes_transferred*/) {
-                session->connection->cancel_timeout();
-                auto cancel_pair = session->connection->cancel_handlers_bool_and_lock();
-                if(cancel_pair.first)
-                  return;
-                if(!ec)
-                  this->find_resource(session);
-                else if(this->on_error)
-                  this->on_error(session->request, ec);
-              });
-            }
-            else
-              this->find_resource(session);
           }
-          else
+
+          if(content_length > num_additional_bytes) {
+            session->connection->set_timeout(config.timeout_content);
+            asio::async_read(*session->connection->socket, session->request->streambuf, asio::transfer_exactly(content_length - num_additional_bytes), [this, session](const error_code &ec, size_t /*bytes_transferred*/) {
+              session->connection->cancel_timeout();
+              auto cancel_pair = session->connection->cancel_handlers_bool_and_lock();
+              if(cancel_pair.first)
+                return;
+              if(!ec)
+                this->find_resource(session);
+              else if(this->on_error)
+                this->on_error(session->request, ec);
+            });
+          }
+          else {
+            if(content_length < num_additional_bytes) {
+              // A pipelining client has sent (part of) the next request already, keep it from being read as content
+              auto &streambuf = session->request->streambuf;
+              std::string data(asio::buffers_begin(streambuf.data()), asio::buffers_end(streambuf.data()));
+              streambuf.consume(streambuf.size());
+              std::ostream stream(&streambuf);
+              stream.write(data.data(), static_cast<std::streamsize>(content_length));
+              session->connection->pipelined_data = data.substr(static_cast<size_t>(content_length));
+            }
             this->find_resource(session);
+          }
         }
         else if(this->on_error)
           this->on_error(session->request, ec);
@@ -543,6 +616,16 @@ namespace SimpleWeb {
         }
       }
       // Find path- and method-match, and call write_response
+      if(!exact_resource.empty()) {
+        auto path_it = exact_resource.find(session->request->path);
+        if(path_it != exact_resource.end()) {
+          auto it = path_it->second.find(session->request->method);
+          if(it != path_it->second.end()) {
+            write_response(session, it->second);
+            return;
+          }
+        }
+      }
       for(auto &regex_method : resource) {
         auto it = regex_method.second.find(session->request->method);
         if(it != regex_method.second.end()) {
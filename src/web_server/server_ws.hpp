@@ -2,7 +2,9 @@
 #define SERVER_WS_HPP
 
 #include "crypto.hpp"
+#include "permessage_deflate.hpp"
 #include "utility.hpp"
+#include "websocket_mask.hpp"
 
 #include <atomic>
 #include <iostream>
@@ -11,6 +13,7 @@
 #include <mutex>
 #include <thread>
 #include <unordered_set>
+#include <vector>
 
 #ifdef USE_STANDALONE_ASIO
 #include <asio.hpp>
@@ -41,6 +44,16 @@ namespace SimpleWeb {
 #endif
 
 namespace SimpleWeb {
+  /// What to do when a message is sent to a connection whose send queue is full.
+  enum class SendQueueOverflowPolicy {
+    /// Discard the oldest queued message(s) that are not yet being written.
+    drop_oldest,
+    /// Discard the message being sent.
+    drop_newest,
+    /// Close the connection.
+    disconnect
+  };
+
   template <class socket_type>
   class SocketServer;
 
@@ -76,6 +89,9 @@ namespace SimpleWeb {
 
       regex::smatch path_match;
 
+      /// Negotiated Sec-WebSocket-Protocol, empty if the client offered none that the server supports
+      std::string protocol;
+
       std::string remote_endpoint_address;
       unsigned short remote_endpoint_port;
 
@@ -153,6 +169,10 @@ namespace SimpleWeb {
         handshake << "Upgrade: websocket\r\n";
         handshake << "Connection: Upgrade\r\n";
         handshake << "Sec-WebSocket-Accept: " << Crypto::Base64::encode(sha1) << "\r\n";
+        if(!protocol.empty())
+          handshake << "Sec-WebSocket-Protocol: " << protocol << "\r\n";
+        if(!extensions.empty())
+          handshake << "Sec-WebSocket-Extensions: " << extensions << "\r\n";
         handshake << "\r\n";
 
         return true;
@@ -162,45 +182,122 @@ namespace SimpleWeb {
 
       class SendData {
       public:
-        SendData(std::shared_ptr<SendStream> header_stream, std::shared_ptr<SendStream> message_stream,
-                 std::function<void(const error_code)> &&callback) noexcept
-            : header_stream(std::move(header_stream)), message_stream(std::move(message_stream)), callback(std::move(callback)) {}
-        std::shared_ptr<SendStream> header_stream;
+        SendData(std::shared_ptr<SendStream> message_stream, std::function<void(const error_code)> &&callback) noexcept
+            : message_stream(std::move(message_stream)), callback(std::move(callback)) {}
+        /// Frame header, at most 10 bytes since server frames are unmasked
+        unsigned char header[10];
+        std::size_t header_length = 0;
+        /// Not consumed by the write, so the same stream can be sent to several connections
         std::shared_ptr<SendStream> message_stream;
         std::function<void(const error_code)> callback;
       };
 
+      /// Maximum number of queued frames gathered into one write
+      static constexpr std::size_t max_frames_per_write = 32;
+
       std::list<SendData> send_queue;
+      std::size_t send_queue_bytes = 0;
+      /// Number of frames at the front of send_queue that are being written
+      std::size_t send_queue_writing = 0;
+
+      std::size_t send_queue_max_count = 0;
+      std::size_t send_queue_max_bytes = 0;
+      SendQueueOverflowPolicy send_queue_overflow_policy = SendQueueOverflowPolicy::drop_oldest;
+      std::atomic<std::size_t> send_queue_dropped{0};
+
+      /// Negotiated Sec-WebSocket-Extensions, sent in the handshake response
+      std::string extensions;
+      std::unique_ptr<PerMessageDeflate> permessage_deflate;
+      std::size_t compression_threshold = 0;
+
+      /// Must be called in strand, before the new message is compressed. The messages being written (and the first one,
+      /// whose write is about to start) are never dropped, nor are control frames (close, ping, pong), nor compressed
+      /// messages that later ones depend on (context takeover), since the client could not decompress anything after them.
+      /// Returns false if the new message should not be queued.
+      bool make_room_in_send_queue(std::size_t length, unsigned char fin_rsv_opcode, const std::function<void(const error_code &)> &callback) {
+        // Never drop control frames (close, ping, pong)
+        if((fin_rsv_opcode & 0x08) != 0)
+          return true;
+
+        auto full = [this, length]() {
+          return (send_queue_max_count > 0 && send_queue.size() + 1 > send_queue_max_count) ||
+                 (send_queue_max_bytes > 0 && send_queue_bytes + length > send_queue_max_bytes);
+        };
+        if(send_queue.empty() || !full())
+          return true;
+
+        error_code ec = asio::error::no_buffer_space;
+        switch(send_queue_overflow_policy) {
+        case SendQueueOverflowPolicy::drop_oldest: {
+          auto can_drop_compressed = !permessage_deflate || permessage_deflate->compresses_independently();
+          auto it = std::next(send_queue.begin(), (std::max)(send_queue_writing, std::size_t(1)));
+          while(it != send_queue.end() && full()) {
+            if((it->header[0] & 0x08) != 0 || (!can_drop_compressed && (it->header[0] & 0x40) != 0)) {
+              ++it;
+              continue;
+            }
+            send_queue_bytes -= it->message_stream->size();
+            if(it->callback)
+              it->callback(ec);
+            it = send_queue.erase(it);
+            send_queue_dropped++;
+          }
+          if(!full())
+            return true;
+          // Only messages that can't be dropped are left, so the new one is dropped instead
+          send_queue_dropped++;
+          if(callback)
+            callback(ec);
+          return false;
+        }
+        case SendQueueOverflowPolicy::disconnect:
+          close();
+          // fall through
+        default:
+          send_queue_dropped++;
+          if(callback)
+            callback(ec);
+          return false;
+        }
+      }
 
+      /// Writes the queued frames, gathering the header and payload of up to max_frames_per_write of them
+      /// into a single write.
       void send_from_queue() {
         auto self = this->shared_from_this();
         strand.post([self]() {
-          asio::async_write(*self->socket, self->send_queue.begin()->header_stream->streambuf, self->strand.wrap([self](const error_code &ec, size_t /*bytes_transferred*/) {
+          std::vector<asio::const_buffer> buffers;
+          auto it = self->send_queue.begin();
+          for(; it != self->send_queue.end() && self->send_queue_writing < max_frames_per_write; ++it, ++self->send_queue_writing) {
+            buffers.emplace_back(it->header, it->header_length);
+            buffers.emplace_back(it->message_stream->streambuf.data());
+          }
+          asio::async_write(*self->socket, buffers, self->strand.wrap([self](const error_code &ec, size_t /*bytes_transferred*/) {
             auto lock = self->handler_runner->continue_lock();
             if(!lock)
               return;
+            auto written_count = self->send_queue_writing;
+            self->send_queue_writing = 0;
             if(!ec) {
-              asio::async_write(*self->socket, self->send_queue.begin()->message_stream->streambuf.data(), self->strand.wrap([self](const error_code &ec, size_t /*bytes_transferred*/) {
-                auto lock = self->handler_runner->continue_lock();
-                if(!lock)
-                  return;
+              for(std::size_t c = 0; c < written_count; c++) {
                 auto send_queued = self->send_queue.begin();
                 if(send_queued->callback)
                   send_queued->callback(ec);
-                if(!ec) {
-                  self->send_queue.erase(send_queued);
-                  if(self->send_queue.size() > 0)
-                    self->send_from_queue();
-                }
-                else
-                  self->send_queue.clear();
-              }));
+                self->send_queue_bytes -= send_queued->message_stream->size();
+                self->send_queue.erase(send_queued);
+              }
+              if(self->send_queue.size() > 0)
+                self->send_from_queue();
             }
             else {
+              // The frames not yet written are discarded without their callbacks, as before
               auto send_queued = self->send_queue.begin();
-              if(send_queued->callback)
-                send_queued->callback(ec);
+              for(std::size_t c = 0; c < written_count; c++, ++send_queued) {
+                if(send_queued->callback)
+                  send_queued->callback(ec);
+              }
               self->send_queue.clear();
+              self->send_queue_bytes = 0;
             }
           }));
         });
@@ -225,37 +322,71 @@ namespace SimpleWeb {
         cancel_timeout();
         set_timeout();
 
-        auto header_stream = std::make_shared<SendStream>();
-
-        size_t length = message_stream->size();
+        auto self = this->shared_from_this();
+        strand.post([self, message_stream, callback, fin_rsv_opcode]() {
+          // Make room for the message before it is compressed, since a compressed message must not be dropped
+          // when the compression context is carried over to the next one. The uncompressed size bounds the compressed one.
+          if(!self->make_room_in_send_queue(message_stream->size(), fin_rsv_opcode, callback))
+            return;
 
-        header_stream->put(static_cast<char>(fin_rsv_opcode));
-        // Unmasked (first length byte<128)
-        if(length >= 126) {
-          size_t num_bytes;
-          if(length > 0xffff) {
-            num_bytes = 8;
-            header_stream->put(127);
-          }
-          else {
-            num_bytes = 2;
-            header_stream->put(126);
+          auto payload_stream = message_stream;
+          auto frame_fin_rsv_opcode = fin_rsv_opcode;
+
+          // Compress in strand, since the compression context depends on the order in which messages are sent.
+          // Only unfragmented text and binary messages are compressed.
+          auto opcode = fin_rsv_opcode & 0x0f;
+          if(self->permessage_deflate && (fin_rsv_opcode & 0x80) && (opcode == 1 || opcode == 2) &&
+             message_stream->size() >= self->compression_threshold) {
+            try {
+              std::string data(asio::buffers_begin(message_stream->streambuf.data()), asio::buffers_end(message_stream->streambuf.data()));
+              payload_stream = std::make_shared<SendStream>();
+              *payload_stream << self->permessage_deflate->compress(data.data(), data.size());
+              frame_fin_rsv_opcode |= 0x40; // RSV1 marks a compressed message
+            }
+            catch(...) {
+              if(callback)
+                callback(asio::error::operation_not_supported);
+              return;
+            }
           }
 
-          for(size_t c = num_bytes - 1; c != static_cast<size_t>(-1); c--)
-            header_stream->put((static_cast<unsigned long long>(length) >> (8 * c)) % 256);
-        }
-        else
-          header_stream->put(static_cast<char>(length));
+          size_t length = payload_stream->size();
+          self->send_queue.emplace_back(payload_stream, callback);
+          auto &send_data = self->send_queue.back();
+          auto header = send_data.header;
+          std::size_t header_length = 0;
+
+          header[header_length++] = frame_fin_rsv_opcode;
+          // Unmasked (first length byte<128)
+          if(length >= 126) {
+            size_t num_bytes;
+            if(length > 0xffff) {
+              num_bytes = 8;
+              header[header_length++] = 127;
+            }
+            else {
+              num_bytes = 2;
+              header[header_length++] = 126;
+            }
 
-        auto self = this->shared_from_this();
-        strand.post([self, header_stream, message_stream, callback]() {
-          self->send_queue.emplace_back(header_stream, message_stream, callback);
+            for(size_t c = num_bytes - 1; c != static_cast<size_t>(-1); c--)
+              header[header_length++] = static_cast<unsigned char>(static_cast<unsigned long long>(length) >> (8 * c));
+          }
+          else
+            header[header_length++] = static_cast<unsigned char>(length);
+          send_data.header_length = header_length;
+
+          self->send_queue_bytes += length;
           if(self->send_queue.size() == 1)
             self->send_from_queue();
         });
       }
 
+      /// Number of messages discarded because the send queue was full.
+      std::size_t dropped_count() const noexcept {
+        return send_queue_dropped;
+      }
+
       void send_close(int status, const std::string &reason = "", const std::function<void(const error_code &)> &callback = nullptr) {
         // Send close only once (in case close is initiated by server)
         if(closed)
@@ -342,6 +473,24 @@ namespace SimpleWeb {
       std::string address;
       /// Set to false to avoid binding the socket to an address that is already in use. Defaults to true.
       bool reuse_address = true;
+      /// Maximum number of messages waiting in each connection's send queue. Defaults to 0 (unlimited).
+      std::size_t send_queue_max_count = 0;
+      /// Maximum total size in bytes of messages waiting in each connection's send queue. Defaults to 0 (unlimited).
+      std::size_t send_queue_max_bytes = 0;
+      /// What to do when a connection's send queue is full. Defaults to dropping the oldest messages.
+      SendQueueOverflowPolicy send_queue_overflow_policy = SendQueueOverflowPolicy::drop_oldest;
+      /// Subprotocols the server supports, the first one offered by the client in Sec-WebSocket-Protocol is selected.
+      std::vector<std::string> subprotocols;
+      /// Accept the permessage-deflate extension (RFC 7692) if offered by the client. Defaults to false.
+      bool permessage_deflate = false;
+      /// zlib compression level, 0-9 or -1 for zlib's default.
+      int compression_level = -1;
+      /// Reset the compression contexts after each message, trading compression ratio for memory. Defaults to false.
+      bool no_context_takeover = false;
+      /// Messages smaller than this size in bytes are sent uncompressed. Defaults to 0.
+      std::size_t compression_threshold = 0;
+      /// Maximum size in bytes of a decompressed message, larger ones close the connection with 1009. Defaults to 0 (unlimited).
+      std::size_t max_inflated_message_size = 0;
     };
     /// Set before calling start().
     Config config;
@@ -495,8 +644,13 @@ namespace SimpleWeb {
         if(regex::regex_match(connection->path, path_match, regex_endpoint.first)) {
           auto write_buffer = std::make_shared<asio::streambuf>();
 
+          negotiate_protocol(connection);
+          negotiate_extensions(connection);
           if(connection->generate_handshake(write_buffer)) {
             connection->path_match = std::move(path_match);
+            connection->send_queue_max_count = config.send_queue_max_count;
+            connection->send_queue_max_bytes = config.send_queue_max_bytes;
+            connection->send_queue_overflow_policy = config.send_queue_overflow_policy;
             connection->set_timeout(config.timeout_request);
             asio::async_write(*connection->socket, *write_buffer, [this, connection, write_buffer, &regex_endpoint](const error_code &ec, size_t /*bytes_transferred*/) {
               connection->cancel_timeout();
@@ -516,6 +670,78 @@ namespace SimpleWeb {
       }
     }
 
+    void negotiate_protocol(const std::shared_ptr<Connection> &connection) {
+      connection->protocol.clear();
+
+      // Select the first subprotocol offered by the client that the server supports
+      auto range = connection->header.equal_range("Sec-WebSocket-Protocol");
+      for(auto it = range.first; it != range.second; ++it) {
+        std::size_t begin = 0;
+        while(begin <= it->second.size()) {
+          auto end = std::min(it->second.find(',', begin), it->second.size());
+          auto offer = it->second.substr(begin, end - begin);
+          begin = end + 1;
+
+          offer.erase(0, offer.find_first_not_of(" \t"));
+          offer.erase(offer.find_last_not_of(" \t") + 1);
+          if(std::find(config.subprotocols.begin(), config.subprotocols.end(), offer) != config.subprotocols.end()) {
+            connection->protocol = offer;
+            return;
+          }
+        }
+      }
+    }
+
+    void negotiate_extensions(const std::shared_ptr<Connection> &connection) {
+      connection->extensions.clear();
+      connection->permessage_deflate = nullptr;
+      if(!config.permessage_deflate)
+        return;
+
+      auto header_it = connection->header.find("Sec-WebSocket-Extensions");
+      if(header_it == connection->header.end())
+        return;
+
+      // Accept the first acceptable permessage-deflate offer
+      for(auto &offer : ExtensionOffer::parse(header_it->second)) {
+        if(offer.name != "permessage-deflate")
+          continue;
+
+        bool acceptable = true;
+        for(auto &param : offer.params) {
+          if(param.first != "server_no_context_takeover" && param.first != "client_no_context_takeover" &&
+             param.first != "server_max_window_bits" && param.first != "client_max_window_bits")
+            acceptable = false;
+        }
+        // zlib can't compress with a raw deflate window of 8 bits
+        auto server_window_bits = offer.window_bits("server_max_window_bits");
+        if(!acceptable || server_window_bits < 9 || offer.window_bits("client_max_window_bits") < 0)
+          continue;
+
+        auto server_no_context_takeover = config.no_context_takeover || offer.params.count("server_no_context_takeover") > 0;
+        auto client_no_context_takeover = config.no_context_takeover || offer.params.count("client_no_context_takeover") > 0;
+
+        try {
+          connection->permessage_deflate = std::unique_ptr<PerMessageDeflate>(new PerMessageDeflate(
+              config.compression_level, server_window_bits, server_no_context_takeover, client_no_context_takeover,
+              config.max_inflated_message_size));
+        }
+        catch(...) {
+          return;
+        }
+        connection->compression_threshold = config.compression_threshold;
+
+        connection->extensions = "permessage-deflate";
+        if(server_no_context_takeover)
+          connection->extensions += "; server_no_context_takeover";
+        if(client_no_context_takeover)
+          connection->extensions += "; client_no_context_takeover";
+        if(server_window_bits < 15)
+          connection->extensions += "; server_max_window_bits=" + std::to_string(server_window_bits);
+        return;
+      }
+    }
+
     void read_message(const std::shared_ptr<Connection> &connection, Endpoint &endpoint) const {
       asio::async_read(*connection->socket, connection->read_buffer, asio::transfer_exactly(2), [this, connection, &endpoint](const error_code &ec, size_t bytes_transferred) {
         auto lock = connection->handler_runner->continue_lock();
@@ -606,20 +832,48 @@ namespace SimpleWeb {
         if(!lock)
           return;
         if(!ec) {
-          std::istream raw_message_data(&connection->read_buffer);
-
-          // Read mask
-          std::vector<unsigned char> mask;
-          mask.resize(4);
-          raw_message_data.read((char *)&mask[0], 4);
+          // The mask and the payload are contiguous in read_buffer, unmask them straight into the message
+          auto raw_message_data = asio::buffer_cast<const unsigned char *>(connection->read_buffer.data());
+          unsigned char mask[4];
+          std::memcpy(mask, raw_message_data, 4);
 
           std::shared_ptr<Message> message(new Message());
           message->length = length;
           message->fin_rsv_opcode = fin_rsv_opcode;
 
+          websocket_mask(asio::buffer_cast<unsigned char *>(message->streambuf.prepare(length)), raw_message_data + 4, length, mask);
+          message->streambuf.commit(length);
+          connection->read_buffer.consume(4 + length);
+
           std::ostream message_data_out_stream(&message->streambuf);
-          for(size_t c = 0; c < length; c++) {
-            message_data_out_stream.put(raw_message_data.get() ^ mask[c % 4]);
+
+          // If compressed (RSV1 set)
+          if((fin_rsv_opcode & 0x40) != 0) {
+            if(!connection->permessage_deflate || (fin_rsv_opcode & 0x08) != 0) {
+              const std::string reason("unexpected reserved bit");
+              connection->send_close(1002, reason);
+              connection_close(connection, endpoint, 1002, reason);
+              return;
+            }
+            try {
+              std::string compressed(asio::buffers_begin(message->streambuf.data()), asio::buffers_end(message->streambuf.data()));
+              message->streambuf.consume(compressed.size());
+              auto decompressed = connection->permessage_deflate->decompress(compressed.data(), compressed.size());
+              message_data_out_stream.write(decompressed.data(), static_cast<std::streamsize>(decompressed.size()));
+              message->length = decompressed.size();
+            }
+            catch(const MessageTooBig &) {
+              const std::string reason("message too big");
+              connection->send_close(1009, reason);
+              connection_close(connection, endpoint, 1009, reason);
+              return;
+            }
+            catch(...) {
+              const std::string reason("invalid compressed data");
+              connection->send_close(1007, reason);
+              connection_close(connection, endpoint, 1007, reason);
+              return;
+            }
           }
 
           // If connection close
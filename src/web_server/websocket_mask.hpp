@@ -0,0 +1,39 @@
+#ifndef SIMPLE_WEB_WEBSOCKET_MASK_HPP
+#define SIMPLE_WEB_WEBSOCKET_MASK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace SimpleWeb {
+  /// XORs size bytes of src with the 4 byte masking key into dst, which may be the same buffer as src.
+  /// Masking and unmasking are the same operation, see https://tools.ietf.org/html/rfc6455#section-5.3.
+  /// Works on 8 byte words, which compilers further vectorize, instead of byte by byte.
+  inline void websocket_mask(unsigned char *dst, const unsigned char *src, std::size_t size, const unsigned char mask[4]) noexcept {
+    unsigned char mask_bytes[8] = {mask[0], mask[1], mask[2], mask[3], mask[0], mask[1], mask[2], mask[3]};
+    std::uint64_t mask_word;
+    std::memcpy(&mask_word, mask_bytes, 8);
+
+    std::size_t c = 0;
+    // The key repeats every 4 bytes, so it lines up with every word starting at a multiple of 8
+    for(; c + 32 <= size; c += 32) {
+      std::uint64_t words[4];
+      std::memcpy(words, src + c, 32);
+      words[0] ^= mask_word;
+      words[1] ^= mask_word;
+      words[2] ^= mask_word;
+      words[3] ^= mask_word;
+      std::memcpy(dst + c, words, 32);
+    }
+    for(; c + 8 <= size; c += 8) {
+      std::uint64_t word;
+      std::memcpy(&word, src + c, 8);
+      word ^= mask_word;
+      std::memcpy(dst + c, &word, 8);
+    }
+    for(; c < size; c++)
+      dst[c] = src[c] ^ mask[c % 4];
+  }
+} // namespace SimpleWeb
+
+#endif /* SIMPLE_WEB_WEBSOCKET_MASK_HPP */